@@ -0,0 +1,492 @@
+/*
+ Argon
+ 
+ Copyright (c) 2016 David McDonagh, Robert Shaw, Staszek Welsh
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+// Benchmarks for the simulation, without openFrameworks. Times each of forcesEnergies, integrate,
+// berendsen, rdf, maxwell and externalForce separately, over a sweep of the number of particles,
+// the pair potential, the number of Gaussians and the number of threads, and writes the results
+// as CSV or JSON on stdout, with progress on stderr.
+//
+// Usage: argon-bench [options]
+//     -n list       numbers of particles (default 50,500,5000,50000,1000000)
+//     -p list       potentials, from lj, square, morse and custom (default all four)
+//     -g list       numbers of Gaussians (default 0,4)
+//     -j list       numbers of threads (default 1,2,4)
+//     -integrator list  integrators, from vv (velocity Verlet) and respa (default vv,respa)
+//     -respa N,split  RESPA inner steps per outer step, and the split distance (default 4,2.0)
+//     -adaptive list  time step modes for integrate, from off and on (default off,on)
+//     -table list   pair potential tables for forcesEnergies, from off (the analytic potential),
+//                   linear and cubic (default off,linear,cubic)
+//     -time t       minimum time in seconds spent timing each kernel (default 0.25)
+//     -rdfmax N     largest number of particles for which rdf is timed (default 1000000)
+//     -format fmt   csv or json (default csv)
+//     -seed seed    seed for the random velocities (default 1)
+//     -drift t      simulated time over which the energy drift is measured, or 0 to skip the
+//                   drift check (default 4)
+//
+// Each row gives the time per call of one kernel, and a number of pairs to normalise it by: the
+// pairs in the neighbour list for forcesEnergies and integrate, particle-Gaussian pairs for
+// externalForce, and particles for berendsen, rdf and maxwell. For the
+// threaded kernels, forcesEnergies and integrate, the efficiency is the speedup over the smallest
+// thread count, divided by the ratio of the thread counts, with the same table or time step mode.
+// The integrate rows also give the
+// simulated time per second and the mean time step, which with an adaptive time step depends on
+// how far the particles move in each step.
+//
+// When RESPA is benchmarked, the drift rows check it against velocity Verlet: for each potential,
+// DRIFT_N particles are equilibrated and then integrated without the thermostat, by velocity
+// Verlet with the inner step dt, RESPA with dt and N inner steps, and velocity Verlet with the
+// outer step N dt. The drift is the slope of the total energy per particle against time. RESPA
+// should drift at most twice as much as velocity Verlet with dt, or as the mean of the two
+// velocity Verlet drifts if that is larger; otherwise this is reported on stderr, and the exit
+// status is 2.
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include "mdforces.hpp"
+
+// Number of particles, and time they are equilibrated for, in the energy drift check
+#define DRIFT_N 1000
+#define DRIFT_EQUILIBRATION 4.0
+
+namespace {
+    struct Options {
+        std::vector <int> Ns = {50, 500, 5000, 50000, 1000000};
+        std::vector <Potential> potentials = {LENNARD_JONES, SQUARE_WELL, MORSE, CUSTOM};
+        std::vector <int> gaussians = {0, 4};
+        std::vector <int> threads = {1, 2, 4};
+        std::vector <md::Integrator> integrators = {md::VELOCITY_VERLET, md::RESPA};
+        int respaSteps = 4;
+        double respaSplit = 2.0;
+        std::vector <bool> adaptive = {false, true};
+        std::vector <std::string> tables = {"off", "linear", "cubic"};
+        double minTime = 0.25;
+        int rdfMax = 1000000;
+        bool json = false;
+        unsigned long long seed = 1;
+        double driftTime = 4.0;
+    };
+    
+    // One line of the results; negative values are not applicable and are left out
+    struct Result {
+        int N;
+        Potential potential;
+        int gaussians;
+        int threads;
+        std::string kernel;
+        std::string table;    // off, linear or cubic, for forcesEnergies
+        std::string integrator; // vv or respa, for integrate and drift
+        std::string timestep; // fixed or adaptive, for integrate
+        long long calls;
+        double nsPerCall;
+        double pairs;
+        double stepsPerSecond;
+        double simTimePerSecond;
+        double meanDt;
+        double drift;
+        double efficiency;
+    };
+    
+    const char *potentialName(Potential potential) {
+        switch (potential) {
+            case LENNARD_JONES: return "lj";
+            case SQUARE_WELL:   return "square";
+            case MORSE:         return "morse";
+            case CUSTOM:        return "custom";
+            default:            return "unknown";
+        }
+    }
+    
+    const char *integratorName(md::Integrator integrator) {
+        return integrator == md::RESPA ? "respa" : "vv";
+    }
+    
+    bool parsePotential(const std::string &name, Potential &potential) {
+        if      (name == "lj")     { potential = LENNARD_JONES; }
+        else if (name == "square") { potential = SQUARE_WELL; }
+        else if (name == "morse")  { potential = MORSE; }
+        else if (name == "custom") { potential = CUSTOM; }
+        else return false;
+        return true;
+    }
+    
+    // Split a comma-separated list
+    std::vector <std::string> splitList(const std::string &list) {
+        std::vector <std::string> items;
+        std::stringstream stream(list);
+        std::string item;
+        while (std::getline(stream, item, ',')) { if (!item.empty()) { items.push_back(item); } }
+        return items;
+    }
+    
+    // Read a comma-separated list of integers of at least min into values
+    bool parseInts(const std::string &list, int min, std::vector <int> &values) {
+        values.clear();
+        for (const std::string &item : splitList(list)) {
+            int value = std::atoi(item.c_str());
+            if (value < min) { return false; }
+            values.push_back(value);
+        }
+        return !values.empty();
+    }
+    
+    void usage(const char *name) {
+        std::cerr << "Usage: " << name << " [-n list] [-p list] [-g list] [-j list] [-time seconds]"
+                  << " [-integrator vv,respa] [-respa N,split] [-adaptive off,on] [-table off,linear,cubic] [-rdfmax N] [-format csv|json] [-seed seed] [-drift time]" << std::endl;
+    }
+    
+    // Read the command line into opts, returning false if it is not understood
+    bool parseArgs(int argc, char **argv, Options &opts) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (i + 1 >= argc) { return false; } // every option takes a value
+            std::string value = argv[++i];
+            
+            if      (arg == "-n") { if (!parseInts(value, 1, opts.Ns)) { return false; } }
+            else if (arg == "-g") { if (!parseInts(value, 0, opts.gaussians)) { return false; } }
+            else if (arg == "-j") { if (!parseInts(value, 1, opts.threads)) { return false; } }
+            else if (arg == "-p") {
+                opts.potentials.clear();
+                for (const std::string &item : splitList(value)) {
+                    Potential potential;
+                    if (!parsePotential(item, potential)) { return false; }
+                    opts.potentials.push_back(potential);
+                }
+                if (opts.potentials.empty()) { return false; }
+            }
+            else if (arg == "-integrator") {
+                opts.integrators.clear();
+                for (const std::string &item : splitList(value)) {
+                    if      (item == "vv")    { opts.integrators.push_back(md::VELOCITY_VERLET); }
+                    else if (item == "respa") { opts.integrators.push_back(md::RESPA); }
+                    else return false;
+                }
+                if (opts.integrators.empty()) { return false; }
+            }
+            else if (arg == "-respa") {
+                std::vector <std::string> items = splitList(value);
+                if (items.empty() || items.size() > 2) { return false; }
+                opts.respaSteps = std::atoi(items[0].c_str());
+                if (items.size() > 1) { opts.respaSplit = std::atof(items[1].c_str()); }
+                if (opts.respaSteps < 1 || !(opts.respaSplit > 0)) { return false; }
+            }
+            else if (arg == "-adaptive") {
+                opts.adaptive.clear();
+                for (const std::string &item : splitList(value)) {
+                    if      (item == "off") { opts.adaptive.push_back(false); }
+                    else if (item == "on")  { opts.adaptive.push_back(true); }
+                    else return false;
+                }
+                if (opts.adaptive.empty()) { return false; }
+            }
+            else if (arg == "-table") {
+                opts.tables = splitList(value);
+                for (const std::string &item : opts.tables) {
+                    if (item != "off" && item != "linear" && item != "cubic") { return false; }
+                }
+                if (opts.tables.empty()) { return false; }
+            }
+            else if (arg == "-time")   { opts.minTime = std::atof(value.c_str()); }
+            else if (arg == "-rdfmax") { opts.rdfMax = std::atoi(value.c_str()); }
+            else if (arg == "-format") {
+                if      (value == "csv")  { opts.json = false; }
+                else if (value == "json") { opts.json = true; }
+                else return false;
+            }
+            else if (arg == "-seed") { opts.seed = std::strtoull(value.c_str(), nullptr, 10); }
+            else if (arg == "-drift") { opts.driftTime = std::atof(value.c_str()); }
+            else return false;
+        }
+        
+        std::sort(opts.threads.begin(), opts.threads.end());
+        return opts.minTime >= 0 && opts.driftTime >= 0;
+    }
+    
+    // Call kernel repeatedly, at least once, until minTime seconds have passed, and return the
+    // mean time per call in nanoseconds, and the number of calls
+    template <class Kernel>
+    double timeKernel(Kernel kernel, double minTime, long long &calls) {
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+        double elapsed = 0;
+        calls = 0;
+        do {
+            kernel();
+            ++calls;
+            elapsed = std::chrono::duration <double> (Clock::now() - start).count();
+        } while (elapsed < minTime);
+        return 1e9 * elapsed / calls;
+    }
+    
+    // Set up a system of N particles at the same density and temperature as the app, with the
+    // given potential and number of Gaussians spread over the box
+    void setupSystem(md::MDContainer &system, int N, Potential potential, int ngaussians, unsigned long long seed) {
+        double L = std::sqrt(N / 0.3);
+        system.setSeed(seed);
+        system.setBox(L, L);
+        system.setTemp(0.5);
+        system.setTimestep(0.002);
+        system.setPotential(potential);
+        for (int g = 0; g < ngaussians; ++g) {
+            double y = std::fmod(0.618034 * (g + 1), 1.0);
+            system.addGaussian(L * (g + 0.5) / ngaussians, L * y);
+        }
+        system.setNAfterReset(N);
+        system.resetSystem();
+    }
+    
+    // Equilibrate DRIFT_N particles with the Berendsen thermostat, then integrate them without it for
+    // time, and return the row for the drift: the slope of a least squares fit of the total energy
+    // per particle against time, along with the steps and simulated time per second
+    Result measureDrift(Potential potential, md::Integrator integrator, int respaSteps, double respaSplit,
+                        double dt, double time, int nthreads, unsigned long long seed) {
+        md::MDContainer system;
+        setupSystem(system, DRIFT_N, potential, 0, seed);
+        system.setTimestep(dt);
+        system.setIntegrator(integrator, respaSteps, respaSplit);
+        
+        int nequil = (int)(DRIFT_EQUILIBRATION / system.getStepTime());
+        for (int i = 0; i < nequil; ++i) {
+            system.integrate(nthreads);
+            system.berendsen(1.0, system.getStepTime());
+            system.flushVelocityScale();
+        }
+        
+        int nsteps = std::max(2, (int)(time / system.getStepTime()));
+        double st = 0, se = 0, stt = 0, ste = 0;
+        system.resetStepStats();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int i = 0; i < nsteps; ++i) {
+            system.integrate(nthreads);
+            double t = system.getStepStats().time;
+            double e = (system.getEPot() + system.getEKin()) / system.getN();
+            st += t; se += e; stt += t * t; ste += t * e;
+        }
+        double elapsed = std::chrono::duration <double> (std::chrono::steady_clock::now() - start).count();
+        
+        md::StepStats stats = system.getStepStats();
+        Result r = {DRIFT_N, potential, 0, nthreads, "drift", "", integratorName(integrator), "fixed",
+                    nsteps, 1e9 * elapsed / nsteps, -1, nsteps / elapsed, stats.time / elapsed,
+                    stats.dtSum / stats.steps, 0, -1};
+        r.drift = std::fabs((nsteps * ste - st * se) / (nsteps * stt - st * st));
+        return r;
+    }
+    
+    void writeCSV(const std::vector <Result> &results) {
+        std::cout << std::setprecision(10);
+        std::cout << "n,potential,gaussians,threads,kernel,table,integrator,timestep,calls,ns_per_call,pairs,ns_per_pair,"
+                  << "steps_per_s,sim_time_per_s,mean_dt,drift,efficiency" << std::endl;
+        for (const Result &r : results) {
+            std::cout << r.N << "," << potentialName(r.potential) << "," << r.gaussians << "," << r.threads << ","
+                      << r.kernel << "," << r.table << "," << r.integrator << "," << r.timestep << "," << r.calls << "," << r.nsPerCall << ",";
+            if (r.pairs > 0)          { std::cout << r.pairs << "," << r.nsPerCall / r.pairs; } else { std::cout << ","; }
+            std::cout << ",";
+            if (r.stepsPerSecond > 0) { std::cout << r.stepsPerSecond; }
+            std::cout << ",";
+            if (r.simTimePerSecond > 0) { std::cout << r.simTimePerSecond; }
+            std::cout << ",";
+            if (r.meanDt > 0)         { std::cout << r.meanDt; }
+            std::cout << ",";
+            if (r.drift >= 0)         { std::cout << r.drift; }
+            std::cout << ",";
+            if (r.efficiency > 0)     { std::cout << r.efficiency; }
+            std::cout << std::endl;
+        }
+    }
+    
+    void writeJSON(const std::vector <Result> &results) {
+        std::cout << std::setprecision(10);
+        std::cout << "{" << std::endl;
+        std::cout << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << "," << std::endl;
+        std::cout << "  \"results\": [" << std::endl;
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            const Result &r = results[i];
+            std::cout << "    {\"n\": " << r.N << ", \"potential\": \"" << potentialName(r.potential) << "\""
+                      << ", \"gaussians\": " << r.gaussians << ", \"threads\": " << r.threads
+                      << ", \"kernel\": \"" << r.kernel << "\"";
+            if (!r.table.empty())     { std::cout << ", \"table\": \"" << r.table << "\""; }
+            if (!r.integrator.empty()) { std::cout << ", \"integrator\": \"" << r.integrator << "\""; }
+            if (!r.timestep.empty())  { std::cout << ", \"timestep\": \"" << r.timestep << "\""; }
+            std::cout << ", \"calls\": " << r.calls << ", \"ns_per_call\": " << r.nsPerCall;
+            if (r.pairs > 0)          { std::cout << ", \"pairs\": " << r.pairs << ", \"ns_per_pair\": " << r.nsPerCall / r.pairs; }
+            if (r.stepsPerSecond > 0) { std::cout << ", \"steps_per_s\": " << r.stepsPerSecond; }
+            if (r.simTimePerSecond > 0) { std::cout << ", \"sim_time_per_s\": " << r.simTimePerSecond; }
+            if (r.meanDt > 0)         { std::cout << ", \"mean_dt\": " << r.meanDt; }
+            if (r.drift >= 0)         { std::cout << ", \"drift\": " << r.drift; }
+            if (r.efficiency > 0)     { std::cout << ", \"efficiency\": " << r.efficiency; }
+            std::cout << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+        }
+        std::cout << "  ]" << std::endl;
+        std::cout << "}" << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    Options opts;
+    if (!parseArgs(argc, argv, opts)) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    std::vector <Result> results;
+    
+    for (int N : opts.Ns) {
+        for (Potential potential : opts.potentials) {
+            for (int ngaussians : opts.gaussians) {
+                std::cerr << "N = " << N << ", " << potentialName(potential) << ", " << ngaussians << " Gaussians" << std::endl;
+                
+                md::MDContainer system;
+                setupSystem(system, N, potential, ngaussians, opts.seed);
+                Result base = {N, potential, ngaussians, 1, "", "", "", "", 0, 0, -1, -1, -1, -1, -1, -1};
+                long long calls;
+                
+                // threaded kernels, with the time for the smallest thread count to compare against,
+                // for each kernel and table, integrator or time step mode
+                std::map <std::string, double> baseTimes;
+                for (int nthreads : opts.threads) {
+                    for (int i = 0; i < 10; ++i) { system.integrate(nthreads); } // settle the list and threads
+                    
+                    Result r = base;
+                    r.threads = nthreads;
+                    
+                    r.kernel = "forcesEnergies";
+                    for (const std::string &table : opts.tables) {
+                        system.setTabulated(table != "off", table == "cubic" ? TABLE_CUBIC : TABLE_LINEAR);
+                        system.forcesEnergies(nthreads); // build the table outside the timing
+                        
+                        r.table = table;
+                        r.nsPerCall = timeKernel([&] { system.forcesEnergies(nthreads); }, opts.minTime, calls);
+                        r.calls = calls;
+                        r.pairs = system.getNListPairs();
+                        std::string key = r.kernel + " " + r.table;
+                        if (nthreads == opts.threads[0]) { baseTimes[key] = r.nsPerCall * nthreads; }
+                        r.efficiency = baseTimes[key] / (r.nsPerCall * nthreads);
+                        results.push_back(r);
+                    }
+                    system.setTabulated(false);
+                    r.table = "";
+                    
+                    // a step is a whole outer step under RESPA, so compare the simulated time per second
+                    r.kernel = "integrate";
+                    for (md::Integrator integrator : opts.integrators) {
+                        system.setIntegrator(integrator, opts.respaSteps, opts.respaSplit);
+                        for (bool adaptive : opts.adaptive) {
+                            system.setAdaptiveTimestep(adaptive);
+                            for (int i = 0; i < 10; ++i) { system.integrate(nthreads); } // let dt adapt
+                            
+                            r.integrator = integratorName(integrator);
+                            r.timestep = adaptive ? "adaptive" : "fixed";
+                            system.resetStepStats();
+                            r.nsPerCall = timeKernel([&] { system.integrate(nthreads); }, opts.minTime, calls);
+                            r.calls = calls;
+                            r.pairs = system.getNListPairs();
+                            r.stepsPerSecond = 1e9 / r.nsPerCall;
+                            md::StepStats stats = system.getStepStats();
+                            r.simTimePerSecond = r.stepsPerSecond * stats.time / stats.steps;
+                            r.meanDt = stats.dtSum / stats.steps;
+                            std::string key = r.kernel + " " + r.integrator + " " + r.timestep;
+                            if (nthreads == opts.threads[0]) { baseTimes[key] = r.nsPerCall * nthreads; }
+                            r.efficiency = baseTimes[key] / (r.nsPerCall * nthreads);
+                            results.push_back(r);
+                        }
+                    }
+                    system.setAdaptiveTimestep(false);
+                    system.setIntegrator(md::VELOCITY_VERLET);
+                }
+                
+                // serial kernels
+                Result r = base;
+                
+                // the rescaling is applied every call, as repeated calls would otherwise compound it
+                r.kernel = "berendsen";
+                r.nsPerCall = timeKernel([&] { system.berendsen(system.getFreq(), system.getStepTime()); system.flushVelocityScale(); }, opts.minTime, calls);
+                r.calls = calls;
+                r.pairs = N;
+                results.push_back(r);
+                
+                if (ngaussians > 0) {
+                    md::ParticleArray target;
+                    target.resize(N);
+                    double etemp = 0;
+                    r.kernel = "externalForce";
+                    r.nsPerCall = timeKernel([&] { system.externalForce(0, N, target, etemp); }, opts.minTime, calls);
+                    r.calls = calls;
+                    r.pairs = (double)N * ngaussians;
+                    results.push_back(r);
+                }
+                
+                if (N <= opts.rdfMax) {
+                    r.kernel = "rdf";
+                    r.nsPerCall = timeKernel([&] { system.rdf(0, 3.0, 100); }, opts.minTime, calls);
+                    r.calls = calls;
+                    r.pairs = N;
+                    results.push_back(r);
+                }
+                
+                r.kernel = "maxwell";
+                r.nsPerCall = timeKernel([&] { system.maxwell(0, 5.0, 100); }, opts.minTime, calls);
+                r.calls = calls;
+                r.pairs = N;
+                results.push_back(r);
+            }
+        }
+    }
+    
+    // energy drift of RESPA against velocity Verlet with its inner and outer steps
+    bool driftOK = true;
+    bool respa = std::find(opts.integrators.begin(), opts.integrators.end(), md::RESPA) != opts.integrators.end();
+    if (respa && opts.driftTime > 0) {
+        double dt = 0.002;
+        int nthreads = opts.threads[0];
+        for (Potential potential : opts.potentials) {
+            std::cerr << "Drift, " << potentialName(potential) << std::endl;
+            
+            Result inner = measureDrift(potential, md::VELOCITY_VERLET, 1, opts.respaSplit, dt, opts.driftTime, nthreads, opts.seed);
+            Result r = measureDrift(potential, md::RESPA, opts.respaSteps, opts.respaSplit, dt, opts.driftTime, nthreads, opts.seed);
+            Result outer = measureDrift(potential, md::VELOCITY_VERLET, 1, opts.respaSplit, opts.respaSteps * dt, opts.driftTime, nthreads, opts.seed);
+            results.push_back(inner);
+            results.push_back(r);
+            results.push_back(outer);
+            
+            double limit = std::max(2 * inner.drift, 0.5 * (inner.drift + outer.drift));
+            if (!(r.drift <= limit)) {
+                std::cerr << "RESPA energy drift " << r.drift << " for " << potentialName(potential)
+                          << " is more than the limit " << limit << " from velocity Verlet" << std::endl;
+                driftOK = false;
+            }
+        }
+    }
+    
+    if (opts.json) { writeJSON(results); } else { writeCSV(results); }
+    
+    return driftOK ? 0 : 2;
+}
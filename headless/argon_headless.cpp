@@ -0,0 +1,294 @@
+/*
+ Argon
+ 
+ Copyright (c) 2016 David McDonagh, Robert Shaw, Staszek Welsh
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+// Command line driver which runs the simulation without openFrameworks or a window, as fast as
+// possible, and reports the final energies, the number of steps per second, the simulated time
+// and the time steps taken. This is for
+// production runs and parameter sweeps on machines where openFrameworks is not installed.
+//
+// Usage: argon-headless [options]
+//     -n N         number of particles (default 1000)
+//     -p name      pair potential: lj, square, morse or custom (default lj)
+//     -T temp      thermostat temperature in reduced units (default 0.5)
+//     -s steps     number of time steps (default 10000)
+//     -j threads   number of threads for the force calculation (default 1)
+//     -dt dt       time step (default 0.002)
+//     -rho rho     number density, setting the size of the square box (default 0.3)
+//     -seed seed   seed for the random velocities and thermostat (default: a random seed)
+//     -load file   carry on from a checkpoint, instead of starting from a grid; -n, -p, -T, -dt,
+//                  -rho and -seed are then taken from the checkpoint
+//     -save file   save a checkpoint at the end of the run, which can be carried on with -load
+//     -traj file   write a trajectory of the positions, velocities and energies, on a thread of its own
+//     -every k     number of steps between trajectory frames (default 100)
+//     -tformat f   trajectory format: bin (doubles), float, delta (float differences between
+//                  frames) or xyz (text) (default bin)
+//     -respa N[,split]  use the RESPA integrator, with N inner steps of dt per outer step and the
+//                  fast forces within split (default 2.0), or off for velocity Verlet (default
+//                  off, or as loaded); -s then counts outer steps
+//     -adaptive [dtMin,dtMax]  adapt the time step to the fastest particle and largest force, between
+//                  dtMin and dtMax (default 0.0005,0.008), starting from dt; or -adaptive off for
+//                  a fixed time step (default off, or as loaded)
+//     -table t     tabulate the pair potential with linear or cubic interpolation, or auto for
+//                  cubic unless the potential has jumps, or off (default off, or as loaded)
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include "mdforces.hpp"
+#include "trajectory.hpp"
+
+// Number of time steps taken by each call to run(). The thermostat acts after every step, and the
+// block size only sets how often the last rescaling is flushed and the energies are saved
+#define STEPS_PER_UPDATE 100
+
+namespace {
+    struct Options {
+        int N = 1000;
+        Potential potential = LENNARD_JONES;
+        double temp = 0.5;
+        int steps = 10000;
+        int nthreads = 1;
+        double dt = 0.002;
+        double rho = 0.3;
+        bool seeded = false;
+        unsigned long long seed = 0;
+        std::string loadPath, savePath;
+        std::string trajPath, trajFormat = "bin";
+        int trajEvery = 100;
+        int adaptive = -1; // 1 for an adaptive time step, 0 for a fixed one, or -1 to keep the default or the checkpoint's setting
+        double dtMin = 0.0005, dtMax = 0.008;
+        int respaSteps = -1; // RESPA inner steps, 0 for velocity Verlet, or -1 to keep the default or the checkpoint's setting
+        double respaSplit = 2.0;
+        std::string table; // empty to keep the default or the checkpoint's setting
+    };
+    
+    void usage(const char *name) {
+        std::cerr << "Usage: " << name << " [-n N] [-p lj|square|morse|custom] [-T temp] [-s steps]"
+                  << " [-j threads] [-dt dt] [-rho density] [-seed seed] [-load file] [-save file]"
+                  << " [-traj file] [-every k] [-tformat bin|float|delta|xyz] [-respa N[,split]|off] [-adaptive [dtMin,dtMax]|off] [-table off|linear|cubic|auto]" << std::endl;
+    }
+    
+    bool parsePotential(const std::string &name, Potential &potential) {
+        if      (name == "lj")     { potential = LENNARD_JONES; }
+        else if (name == "square") { potential = SQUARE_WELL; }
+        else if (name == "morse")  { potential = MORSE; }
+        else if (name == "custom") { potential = CUSTOM; }
+        else return false;
+        return true;
+    }
+    
+    bool parseTable(const std::string &name, bool &on, TableInterpolation &interpolation) {
+        on = name != "off";
+        if      (name == "linear") { interpolation = TABLE_LINEAR; }
+        else if (name == "cubic")  { interpolation = TABLE_CUBIC; }
+        else if (name == "auto" || name == "off") { interpolation = TABLE_AUTO; }
+        else return false;
+        return true;
+    }
+    
+    // Read "N" or "N,split" for -respa, or "off"
+    bool parseRespa(const std::string &value, Options &opts) {
+        if (value == "off") { opts.respaSteps = 0; return true; }
+        std::string::size_type comma = value.find(',');
+        opts.respaSteps = std::atoi(value.substr(0, comma).c_str());
+        if (comma != std::string::npos) { opts.respaSplit = std::atof(value.substr(comma + 1).c_str()); }
+        return opts.respaSteps > 0 && opts.respaSplit > 0;
+    }
+    
+    // Read "dtMin,dtMax" for -adaptive, or "off", or nothing for the defaults
+    bool parseAdaptive(const std::string &value, Options &opts) {
+        if (value == "off") { opts.adaptive = 0; return true; }
+        opts.adaptive = 1;
+        if (value.empty()) { return true; }
+        std::string::size_type comma = value.find(',');
+        if (comma == std::string::npos) { return false; }
+        opts.dtMin = std::atof(value.substr(0, comma).c_str());
+        opts.dtMax = std::atof(value.substr(comma + 1).c_str());
+        return opts.dtMin > 0 && opts.dtMax >= opts.dtMin && std::isfinite(opts.dtMax);
+    }
+    
+    // Read the command line into opts, returning false if it is not understood
+    bool parseArgs(int argc, char **argv, Options &opts) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            
+            // the value of -adaptive is optional
+            if (arg == "-adaptive") {
+                bool hasValue = i + 1 < argc && argv[i + 1][0] != '-';
+                if (!parseAdaptive(hasValue ? argv[++i] : "", opts)) { return false; }
+                continue;
+            }
+            
+            if (i + 1 >= argc) { return false; } // every other option takes a value
+            const char *value = argv[++i];
+            
+            if      (arg == "-n")    { opts.N = std::atoi(value); }
+            else if (arg == "-p")    { if (!parsePotential(value, opts.potential)) { return false; } }
+            else if (arg == "-T")    { opts.temp = std::atof(value); }
+            else if (arg == "-s")    { opts.steps = std::atoi(value); }
+            else if (arg == "-j")    { opts.nthreads = std::atoi(value); }
+            else if (arg == "-dt")   { opts.dt = std::atof(value); }
+            else if (arg == "-rho")  { opts.rho = std::atof(value); }
+            else if (arg == "-seed") { opts.seeded = true; opts.seed = std::strtoull(value, nullptr, 10); }
+            else if (arg == "-load") { opts.loadPath = value; }
+            else if (arg == "-save") { opts.savePath = value; }
+            else if (arg == "-traj") { opts.trajPath = value; }
+            else if (arg == "-every") { opts.trajEvery = std::atoi(value); }
+            else if (arg == "-tformat") { opts.trajFormat = value; }
+            else if (arg == "-respa") { if (!parseRespa(value, opts)) { return false; } }
+            else if (arg == "-table") {
+                bool on;
+                TableInterpolation interpolation;
+                if (!parseTable(value, on, interpolation)) { return false; }
+                opts.table = value;
+            }
+            else return false;
+        }
+        
+        return opts.N > 0 && opts.steps >= 0 && opts.nthreads > 0 && opts.dt > 0 && opts.rho > 0 && opts.trajEvery > 0;
+    }
+    
+    // The trajectory format called name, or nullptr if there is none
+    md::TrajectoryFormat* makeTrajectoryFormat(const std::string &name) {
+        if      (name == "bin")   { return new md::BinaryTrajectory(); }
+        else if (name == "float") { return new md::BinaryTrajectory(md::BinaryTrajectory::FLOAT); }
+        else if (name == "delta") { return new md::BinaryTrajectory(md::BinaryTrajectory::DELTA); }
+        else if (name == "xyz")   { return new md::XYZTrajectory(); }
+        else return nullptr;
+    }
+}
+
+int main(int argc, char **argv) {
+    Options opts;
+    if (!parseArgs(argc, argv, opts)) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    md::MDContainer system;
+    if (!opts.loadPath.empty()) {
+        if (!system.loadCheckpoint(opts.loadPath)) {
+            std::cerr << "Could not load checkpoint " << opts.loadPath << std::endl;
+            return 1;
+        }
+        system.setRunning(true);
+    } else {
+        if (opts.seeded) { system.setSeed(opts.seed); }
+        
+        double L = std::sqrt(opts.N / opts.rho);
+        system.setBox(L, L);
+        system.setTemp(opts.temp);
+        system.setTimestep(opts.dt);
+        system.setPotential(opts.potential);
+        system.setNAfterReset(opts.N);
+        system.resetSystem();
+        system.forcesEnergies(opts.nthreads);
+    }
+    
+    // these apply on top of a checkpoint too, with the forces recalculated to match
+    if (opts.respaSteps > 0) {
+        system.setIntegrator(md::RESPA, opts.respaSteps, opts.respaSplit);
+    } else if (opts.respaSteps == 0) {
+        system.setIntegrator(md::VELOCITY_VERLET);
+    }
+    if (opts.adaptive >= 0) { system.setAdaptiveTimestep(opts.adaptive == 1, opts.dtMin, opts.dtMax); }
+    if (!opts.table.empty()) {
+        bool on;
+        TableInterpolation interpolation;
+        parseTable(opts.table, on, interpolation);
+        system.setTabulated(on, interpolation);
+        system.forcesEnergies(opts.nthreads);
+    }
+    
+    md::TrajectoryWriter trajectory;
+    if (!opts.trajPath.empty()) {
+        md::TrajectoryFormat *format = makeTrajectoryFormat(opts.trajFormat);
+        if (!format) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (!trajectory.open(opts.trajPath, format, opts.trajEvery)) {
+            std::cerr << "Could not open trajectory " << opts.trajPath << std::endl;
+            return 1;
+        }
+        system.setTrajectory(&trajectory);
+    }
+    
+    // run in blocks of STEPS_PER_UPDATE steps, as the app does once per frame, but with no frames
+    system.resetStepStats();
+    auto start = std::chrono::steady_clock::now();
+    int stepsDone = 0;
+    while (stepsDone < opts.steps) {
+        int nsteps = std::min(STEPS_PER_UPDATE, opts.steps - stepsDone);
+        system.setStepsPerUpdate(nsteps);
+        system.run(opts.nthreads);
+        stepsDone += nsteps;
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration <double> (end - start).count();
+    
+    // the simulation is timed without waiting for the last frames to be written
+    system.setTrajectory(nullptr);
+    trajectory.close();
+    
+    std::cout << std::setprecision(10);
+    std::cout << "N = " << system.getN() << ", box = " << system.getWidth() << " x " << system.getHeight() << ", "
+              << opts.nthreads << " thread" << (opts.nthreads == 1 ? "" : "s") << std::endl;
+    std::cout << "seed = " << system.getSeed() << std::endl;
+    std::cout << "steps = " << stepsDone << ", time = " << seconds << " s" << std::endl;
+    std::cout << "EPot = " << system.getEPot() << ", EKin = " << system.getEKin()
+              << ", T = " << system.getEKin() / system.getN() << " (target " << system.getTemp() << ")" << std::endl;
+    std::cout << "steps/s = " << (seconds > 0 ? stepsDone / seconds : 0) << std::endl;
+    
+    md::StepStats stats = system.getStepStats();
+    if (stats.steps > 0) {
+        std::cout << "simulated time = " << stats.time << ", per second = " << (seconds > 0 ? stats.time / seconds : 0) << std::endl;
+        std::cout << "dt = " << stats.dtSum / stats.steps << " mean, " << stats.dtMin << " min, " << stats.dtMax << " max"
+                  << (system.getIntegrator() == md::RESPA ? " (inner steps)" : "") << std::endl;
+    }
+    
+    if (!opts.trajPath.empty()) {
+        md::TrajectoryStats stats = trajectory.getStats();
+        std::cout << "trajectory: " << stats.framesWritten << " frames, " << stats.bytesWritten << " bytes, "
+                  << stats.framesDropped << " dropped, at most " << stats.maxQueued << " queued" << std::endl;
+        if (stats.failed) {
+            std::cerr << "Could not write trajectory " << opts.trajPath << std::endl;
+            return 1;
+        }
+    }
+    
+    if (!opts.savePath.empty()) {
+        if (!system.saveCheckpoint(opts.savePath)) {
+            std::cerr << "Could not save checkpoint " << opts.savePath << std::endl;
+            return 1;
+        }
+        std::cout << "saved " << opts.savePath << std::endl;
+    }
+    
+    return 0;
+}
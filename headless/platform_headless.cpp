@@ -0,0 +1,82 @@
+/*
+ Argon
+ 
+ Copyright (c) 2016 David McDonagh, Robert Shaw, Staszek Welsh
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+// Platform-specific layer for builds without a window, e.g. the headless driver on a build node.
+// The simulation code only needs coord and rect from platform.hpp, but platform.cpp also defines
+// the generic image, font and mesh methods, which call these; here they do nothing.
+
+#include "platform.hpp"
+
+/*
+    ArgonImage
+ */
+
+ArgonImage::ArgonImage()  { base = nullptr; }
+ArgonImage::~ArgonImage() {}
+
+void ArgonImage::loadPNG(const std::string &filename) {}
+double ArgonImage::getWidth()  const { return 0; }
+double ArgonImage::getHeight() const { return 0; }
+void ArgonImage::draw(double x, double y, double width, double height, RGB colour) const {}
+
+/*
+    ArgonFont
+ */
+
+ArgonFont::ArgonFont()  { base = nullptr; }
+ArgonFont::~ArgonFont() {}
+
+void ArgonFont::loadTTF(const std::string &filename, int size) {}
+double ArgonFont::getAscenderHeight()  const { return 0; }
+double ArgonFont::getDescenderHeight() const { return 0; }
+double ArgonFont::getTextWidth(const std::string &text) const { return 0; }
+void ArgonFont::drawText(double x, double y, RGB colour, const std::string &text) const {}
+
+/*
+    ArgonMesh
+ */
+
+void ArgonMesh::draw(RGB colour, MeshPrimitive primitive, double linewidth) const {}
+
+/*
+    Drawing functions
+ */
+
+void drawLine(double x0, double y0, double x1, double y1, double width, RGB colour) {}
+void drawRect(double x0, double y0, double width, double height, RGB colour) {}
+void drawEllipse(double x, double y, double rx, double ry, RGB colour, int resolution) {}
+
+void setScissorClip(double x, double y, double width, double height) {}
+void setScissorClip() {}
+
+/*
+    Other functions
+ */
+
+int windowWidth()  { return 0; }
+int windowHeight() { return 0; }
+
+double timeElapsed() { return 0; }
+
+std::string dataPath(const std::string &filename) { return filename; }
@@ -197,7 +197,7 @@ void argon::Initialise() {
     
     
     potentialUI = gui::UIContainer(50, 50, 924, 500);
-    potentialUI.addChild(new gui::PotentialContainer(theSystem, uiFont12, ljThumbnail, squareThumbnail, morseThumbnail, customThumbnail, resetSplinePointsButton));
+    potentialContainerIndex = potentialUI.addIndexedChild(new gui::PotentialContainer(theSystem, uiFont12, ljThumbnail, squareThumbnail, morseThumbnail, customThumbnail, resetSplinePointsButton));
     
     potentialUI.mouseReleased(0, 0, 0);
     
@@ -343,16 +343,23 @@ void argon::Initialise() {
     //tutorialBlockUI.addChild(new gui::RectAtom(RGB(255,0,255, 80), 0, 0, 30, 30));
     tutorialBlockUI.mouseReleased(0, 0, 0);
     
+    // Start running the simulation on its own thread
+    physicsThread.start(N_THREADS, TICK_RATE);
 }
 
 /*
 ROUTINE Run:
     Part of the infinite update / draw loop.
     Update the status of the application, and then draw a frame.
+ 
+    The simulation itself runs on the physics thread, which integrates the equations of motion
+    stepsPerUpdate times and thermostats (Berendsen) with a frequency of 0.1, TICK_RATE times a
+    second, calculating the forces on N_THREADS threads, and publishes a snapshot of the system
+    after each update. Everything drawn in a frame comes from the latest snapshot.
 
-    Currently performs the following tasks, when the simulation is not paused (i.e when playOn):
+    Currently performs the following tasks:
         
-        1. Integrates the equations of motion 5 times and thermostats (Berendsen) with a frequency of 0.1
+        1. Picks up the latest snapshot of the system
         2. If the audio input is turned on:
             - Calculates the smoothed volume scaled between 0 and 1
             - Updates the amplitude, exponent, and drawing of the selected Gaussian according to 
@@ -362,10 +369,13 @@ ROUTINE Run:
 */
 
 void argon::Run() {
-    // If not paused, integrate the system
-    theSystem.run();
+    // Draw the most recent state of the system
+    theSystem.acquireSnapshot();
         
     if (getMicActive()) {
+        // the selected Gaussian is changed, so hold the physics thread
+        std::lock_guard <md::PhysicsThread> guard(physicsThread);
+        
         // get volume, scaled to between 0 and 1
         double scaledVol = getMicVolume();
         
@@ -430,8 +440,15 @@ void argon::Run() {
         p/P = pause/restart the simulation
         d/D = open/close drawable pair potential
         x/X = skip loading fade-in animation
+        s/S = save a checkpoint of the system
+        o/O = open the last checkpoint saved, replacing the system
+ 
+    Input events can change the system, e.g. by resetting it or moving a Gaussian, so the
+    handlers hold the physics thread while they run.
  */
 void argon::KeyPress(unsigned char key) {
+    std::lock_guard <md::PhysicsThread> guard(physicsThread);
+    
     if (key == 'a' || key == 'A') { // Audio on/off
         toggleMicActive();
     }
@@ -468,12 +485,27 @@ void argon::KeyPress(unsigned char key) {
     else if (key == 'x' || key == 'X') { // Skip loading
         loading = false;
     }
+    
+    else if (key == 's' || key == 'S') { // Save a checkpoint
+        if (!theSystem.saveCheckpoint(dataPath(CHECKPOINT_FILE))) { printf("Could not save %s\n", CHECKPOINT_FILE); }
+    }
+    
+    else if (key == 'o' || key == 'O') { // Open the checkpoint, and make the Gaussians and potential UI match it
+        if (theSystem.loadCheckpoint(dataPath(CHECKPOINT_FILE))) {
+            ((gui::GaussianContainer *)systemUI.getChild(gaussianContainerIndex))->syncWithSystem();
+            ((gui::PotentialContainer *)potentialUI.getChild(potentialContainerIndex))->syncWithSystem();
+        } else {
+            printf("Could not open %s\n", CHECKPOINT_FILE);
+        }
+    }
 }
 
 void argon::KeyRelease(unsigned char key) {
 }
 
 void argon::MouseMove(int x, int y) {
+    std::lock_guard <md::PhysicsThread> guard(physicsThread);
+    
     tutorialUI.mouseMoved(x, y);
     controlsUI.mouseMoved(x, y);
     potentialUI.mouseMoved(x, y);
@@ -481,6 +513,8 @@ void argon::MouseMove(int x, int y) {
 }
 
 void argon::MousePress(int x, int y, int button) {
+    std::lock_guard <md::PhysicsThread> guard(physicsThread);
+    
     // pass through mouse press to UI elements
     // stop when the first function returns true and the event is handled
     // slight abuse of short-circuiting boolean or, but it avoids an ugly ifelse tree
@@ -531,6 +565,8 @@ void argon::MousePress(int x, int y, int button) {
 
 
 void argon::MouseRelease(int x, int y, int button) {
+    std::lock_guard <md::PhysicsThread> guard(physicsThread);
+    
     tutorialUI.mouseReleased(x, y, button);
     controlsUI.mouseReleased(x, y, button);
     potentialUI.mouseReleased(x, y, button);
@@ -31,6 +31,7 @@
 #include "platform.hpp"
 #include "utilities.hpp"
 #include "mdforces.hpp"
+#include "physicsthread.hpp"
 #include "gaussian.hpp"
 #include "gui_base.hpp"
 #include "gui_derived.hpp"
@@ -42,12 +43,16 @@
 #include <ciso646>
 
 #define N_THREADS 1 // Number of threads to be used in the forces calculations
+#define TICK_RATE 60 // Number of times per second the physics thread runs stepsPerUpdate steps
+#define CHECKPOINT_FILE "argon.checkpoint" // File in the data folder saved to and opened from with s and o
 
 namespace argon {
     md::MDContainer theSystem; // The MD simulation system
+    md::PhysicsThread physicsThread(theSystem); // Thread which runs theSystem, independently of drawing
     
     int splineContainerIndex; // Index of spline container in potentialUI
     int gaussianContainerIndex; // Index of gaussian container in systemUI
+    int potentialContainerIndex; // Index of potential container in potentialUI
     int systemAtomIndex; // Index of the system atom in systemUI
     int infoTextIndex; // Index of the text atom in infoUI
     int optionsIndex; // Index of the atoms list atom in controlsUI
@@ -0,0 +1,385 @@
+/*
+ Argon
+ 
+ Copyright (c) 2016 David McDonagh, Robert Shaw, Staszek Welsh
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+// Saving and loading of MDContainer checkpoints, in the format described in checkpoint.hpp
+
+#include "mdforces.hpp"
+#include "checkpoint.hpp"
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <initializer_list>
+
+namespace md {
+    
+    namespace {
+        // A piece of the data of a section, which may be spread over several arrays
+        struct Chunk
+        {
+            const void *data;
+            std::size_t size;
+        };
+        
+        // A section found in a mapped checkpoint, with data nullptr if it was not there
+        struct Section
+        {
+            const char *data;
+            checkpoint::SectionHeader header;
+        };
+        
+        std::uint64_t padding(std::uint64_t size) { return (8 - size % 8) % 8; }
+        
+        // Write a section made up of the given chunks, then its padding, returning false on an error
+        bool writeSection(FILE *file, checkpoint::Tag tag, std::uint32_t count, std::initializer_list <Chunk> chunks) {
+            checkpoint::SectionHeader header = {(std::uint32_t)tag, count, 0};
+            for (const Chunk &chunk : chunks) { header.size += chunk.size; }
+            
+            bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+            for (const Chunk &chunk : chunks) {
+                if (ok && chunk.size > 0) { ok = fwrite(chunk.data, 1, chunk.size, file) == chunk.size; }
+            }
+            
+            static const char zeros[8] = {0};
+            std::size_t pad = padding(header.size);
+            if (ok && pad > 0) { ok = fwrite(zeros, 1, pad, file) == pad; }
+            return ok;
+        }
+        
+        // True if the section is there and holds exactly n doubles
+        bool hasDoubles(const Section &section, std::uint64_t n) {
+            return section.data && section.header.size == n * sizeof(double);
+        }
+        
+        // Copy n doubles starting from the kth double of a section into an array
+        void copyDoubles(double *target, const Section &section, std::uint64_t k, int n) {
+            if (n > 0) { memcpy(target, section.data + k * sizeof(double), n * sizeof(double)); }
+        }
+        
+        // The values stored in a sliding window, oldest first, so that pushing them back in order
+        // restores the window
+        std::vector <double> windowValues(const util::SlidingWindow &window) {
+            std::vector <double> values;
+            for (int i = window.size() - 1; i >= 0; --i) { values.push_back(window.get(i)); }
+            return values;
+        }
+        
+        // True if a section holding a sliding window is missing, which is allowed, or holds a
+        // capacity of at most MAX_HISTORY and no more values than that
+        bool validWindow(const Section &section) {
+            if (!section.data) { return true; }
+            return section.header.count > 0 && section.header.count <= checkpoint::MAX_HISTORY &&
+                section.header.size % sizeof(double) == 0 && section.header.size / sizeof(double) <= section.header.count;
+        }
+        
+        // True if a section of n-double items is missing, which is allowed, or holds count of them
+        bool validItems(const Section &section, std::uint64_t n) {
+            return !section.data || hasDoubles(section, n * section.header.count);
+        }
+        
+        // Restore a window from a section which has passed validWindow
+        void restoreWindow(util::SlidingWindow &window, const Section &section) {
+            if (!section.data) {
+                window.clear();
+                return;
+            }
+            
+            window.setCapacity(section.header.count);
+            std::uint64_t n = section.header.size / sizeof(double);
+            for (std::uint64_t i = 0; i < n; ++i) {
+                double v;
+                memcpy(&v, section.data + i * sizeof(double), sizeof(double));
+                window.push(v);
+            }
+        }
+    }
+    
+    /*
+        ROUTINE saveCheckpoint:
+            Writes everything needed to carry on the simulation to a checkpoint file at path: the
+            settings, the particles and their forces, the Gaussians, the custom potential, the
+            energy histories and the state of the random number generator. The file is written
+            under a temporary name and only renamed to path once it is complete, so a failed save
+            leaves any earlier checkpoint at path alone. Returns false if it could not be written.
+     */
+    bool MDContainer::saveCheckpoint(const std::string &path) const
+    {
+        checkpoint::Settings s = {};
+        s.N = N;
+        s.NAfterReset = NAfterReset;
+        s.running = running;
+        s.stepsPerUpdate = stepsPerUpdate;
+        s.potential = potential->getType();
+        s.integrator = integrator;
+        s.tabulated = potential->isTabulated();
+        s.tableInterpolation = potential->getTableInterpolation();
+        s.tableSize = potential->getTableSize();
+        s.respaSteps = respaSteps;
+        s.adaptiveDt = adaptiveDt;
+        s.seed = rng.getSeed();
+        s.rngDraws = rngDraws;
+        s.boxWidth = box_dimensions.x;
+        s.boxHeight = box_dimensions.y;
+        s.rcutoff = rcutoff;
+        s.skin = skin;
+        s.dt = dt;
+        s.fixedDt = fixedDt;
+        s.T = T;
+        s.freq = freq;
+        s.dtMin = dtMin;
+        s.dtMax = dtMax;
+        s.maxStep = maxStep;
+        s.dtGrowth = dtGrowth;
+        s.dtShrink = dtShrink;
+        s.respaSplit = respaSplit;
+        s.epot = epot;
+        s.ekin = ekin;
+        s.v_avg = v_avg;
+        s.sumAbsVel = sumAbsVel;
+        s.velocityScale = velocityScale;
+        s.maxForce2 = maxForce2;
+        s.maxSpeed2 = maxSpeed2;
+        
+        std::vector <double> gaussianData;
+        for (const Gaussian &g : gaussians) {
+            double values[4] = {g.getgAmp(), g.getgAlpha(), g.getgex0(), g.getgey0()};
+            gaussianData.insert(gaussianData.end(), values, values + 4);
+        }
+        
+        std::vector <double> splineData;
+        for (const cubic::Point &p : customPotential.getPoints()) {
+            double values[3] = {p.x, p.y, p.m};
+            splineData.insert(splineData.end(), values, values + 3);
+        }
+        
+        std::vector <double> epotValues = windowValues(prevEPot);
+        std::vector <double> ekinValues = windowValues(prevEKin);
+        std::vector <double> dtValues = windowValues(prevDt);
+        
+        bool saveSlowForces = integrator == RESPA && slowForcesValid && slowForces.size() == N;
+        
+        checkpoint::Header header;
+        memcpy(header.magic, checkpoint::MAGIC, sizeof(header.magic));
+        header.version = checkpoint::VERSION;
+        header.byteOrder = checkpoint::ENDIAN_CHECK;
+        header.nSections = saveSlowForces ? 8 : 7;
+        
+        std::string tmpPath = path + ".tmp";
+        FILE *file = fopen(tmpPath.c_str(), "wb");
+        if (!file) { return false; }
+        
+        std::size_t n = N * sizeof(double);
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+            && writeSection(file, checkpoint::SETTINGS, 1, {{&s, sizeof(s)}})
+            && writeSection(file, checkpoint::PARTICLES, N, {
+                {positions.x.data(), n}, {positions.y.data(), n},
+                {velocities.x.data(), n}, {velocities.y.data(), n},
+                {forces.x.data(), n}, {forces.y.data(), n}})
+            && (!saveSlowForces || writeSection(file, checkpoint::SLOW_FORCES, N, {{slowForces.x.data(), n}, {slowForces.y.data(), n}}))
+            && writeSection(file, checkpoint::GAUSSIANS, gaussians.size(), {{gaussianData.data(), gaussianData.size() * sizeof(double)}})
+            && writeSection(file, checkpoint::SPLINE_POINTS, splineData.size() / 3, {{splineData.data(), splineData.size() * sizeof(double)}})
+            && writeSection(file, checkpoint::EPOT_HISTORY, prevEPot.getCapacity(), {{epotValues.data(), epotValues.size() * sizeof(double)}})
+            && writeSection(file, checkpoint::EKIN_HISTORY, prevEKin.getCapacity(), {{ekinValues.data(), ekinValues.size() * sizeof(double)}})
+            && writeSection(file, checkpoint::DT_HISTORY, prevDt.getCapacity(), {{dtValues.data(), dtValues.size() * sizeof(double)}});
+        ok = fclose(file) == 0 && ok;
+        
+        if (ok) {
+#ifdef _WIN32
+            remove(path.c_str()); // rename will not replace an existing file on Windows
+#endif
+            ok = rename(tmpPath.c_str(), path.c_str()) == 0;
+        }
+        if (!ok) { remove(tmpPath.c_str()); }
+        return ok;
+    }
+    
+    /*
+        ROUTINE loadCheckpoint:
+            Replaces the state of the system with that saved in the checkpoint file at path. The
+            file is memory-mapped, and the particle arrays are copied straight out of the mapping
+            into place. Everything is checked before anything is changed, so if the file cannot be
+            read, is not a checkpoint, is from a newer version or a machine with the other byte
+            order, is cut short, or holds a section or setting out of range, false is returned and
+            the system is left as it was.
+     
+            The trails and the averaged speed distribution are not saved, so start again, and the
+            neighbour lists are rebuilt at the next step.
+     */
+    bool MDContainer::loadCheckpoint(const std::string &path)
+    {
+        util::MappedFile file;
+        if (!file.open(path)) { return false; }
+        const char *data = file.getData();
+        std::size_t size = file.getSize();
+        
+        checkpoint::Header header;
+        if (size < sizeof(header)) { return false; }
+        memcpy(&header, data, sizeof(header));
+        if (memcmp(header.magic, checkpoint::MAGIC, sizeof(header.magic)) != 0 ||
+            header.byteOrder != checkpoint::ENDIAN_CHECK || header.version > checkpoint::VERSION) {
+            return false;
+        }
+        
+        // Find the sections, checking that each lies inside the file; any unknown ones are skipped
+        Section sections[checkpoint::N_TAGS] = {};
+        std::size_t offset = sizeof(header);
+        for (std::uint64_t i = 0; i < header.nSections; ++i) {
+            checkpoint::SectionHeader section;
+            if (size - offset < sizeof(section)) { return false; }
+            memcpy(&section, data + offset, sizeof(section));
+            offset += sizeof(section);
+            
+            if (section.size > size - offset) { return false; }
+            if (section.tag < checkpoint::N_TAGS) {
+                sections[section.tag].data = data + offset;
+                sections[section.tag].header = section;
+            }
+            offset += std::min <std::uint64_t> (section.size + padding(section.size), size - offset);
+        }
+        
+        // The settings and the particles must be there and make sense; the rest are optional, but
+        // must be well formed if they are there, so that nothing has to be checked once the state
+        // of the system starts to change
+        checkpoint::Settings s;
+        const Section &settings = sections[checkpoint::SETTINGS];
+        if (!settings.data || settings.header.size < sizeof(s)) { return false; }
+        memcpy(&s, settings.data, sizeof(s));
+        
+        // A saved file only holds values which the setters accept, so anything else means the file
+        // is corrupt; the setters also check the values as they are restored
+        double values[] = {s.boxWidth, s.boxHeight, s.rcutoff, s.skin, s.dt, s.fixedDt, s.T, s.freq, s.respaSplit,
+                           s.dtMin, s.dtMax, s.maxStep, s.dtGrowth, s.dtShrink,
+                           s.epot, s.ekin, s.v_avg, s.sumAbsVel, s.velocityScale, s.maxForce2, s.maxSpeed2};
+        for (double x : values) {
+            if (!std::isfinite(x)) { return false; }
+        }
+        if (s.N < 0 || s.NAfterReset < 0 || s.stepsPerUpdate < 0 ||
+            s.potential < LENNARD_JONES || s.potential > CUSTOM ||
+            s.integrator < VELOCITY_VERLET || s.integrator > RESPA ||
+            s.respaSteps < 1 || !(s.respaSplit > RESPA_SWITCH_WIDTH) ||
+            s.tableSize < 0 || s.tableSize > checkpoint::MAX_TABLE_SIZE ||
+            !(s.boxWidth > 0) || !(s.boxHeight > 0) || !(s.dt > 0) || !(s.fixedDt > 0) ||
+            !(s.rcutoff > 0) || !(s.skin >= 0) || !(s.T >= 0) || !(s.freq >= 0) ||
+            !(s.dtMin > 0) || !(s.dtMax >= s.dtMin) || !(s.maxStep > 0) || !(s.dtGrowth >= 1) ||
+            !(s.dtShrink > 0) || !(s.dtShrink <= 1) || !(s.velocityScale > 0)) {
+            return false;
+        }
+        
+        const Section &particles = sections[checkpoint::PARTICLES];
+        if (particles.header.count != (std::uint32_t)s.N || !hasDoubles(particles, 6 * (std::uint64_t)s.N)) { return false; }
+        
+        const Section &slow = sections[checkpoint::SLOW_FORCES];
+        if (slow.data && (slow.header.count != (std::uint32_t)s.N || !hasDoubles(slow, 2 * (std::uint64_t)s.N))) { return false; }
+        
+        const Section &gaussianSection = sections[checkpoint::GAUSSIANS];
+        const Section &splineSection = sections[checkpoint::SPLINE_POINTS];
+        if (!validItems(gaussianSection, 4) || !validItems(splineSection, 3)) { return false; }
+        
+        if (!validWindow(sections[checkpoint::EPOT_HISTORY]) || !validWindow(sections[checkpoint::EKIN_HISTORY]) ||
+            !validWindow(sections[checkpoint::DT_HISTORY])) {
+            return false;
+        }
+        
+        // Everything checks out, so replace the state of the system
+        N = s.N;
+        setNAfterReset(s.NAfterReset);
+        running = s.running != 0;
+        setStepsPerUpdate(s.stepsPerUpdate);
+        setBox(s.boxWidth, s.boxHeight);
+        setCutoff(s.rcutoff);
+        setSkin(s.skin);
+        setTimestep(s.fixedDt);
+        setTemp(s.T);
+        setFreq(s.freq);
+        setAdaptiveTimestep(s.adaptiveDt != 0, s.dtMin, s.dtMax, s.maxStep, s.dtGrowth, s.dtShrink);
+        dt = s.dt;
+        // as setIntegrator, whose values were checked above, without it recalculating the forces
+        integrator = (Integrator)s.integrator;
+        respaSteps = s.respaSteps;
+        respaSplit = s.respaSplit;
+        epot = s.epot;
+        ekin = s.ekin;
+        v_avg = s.v_avg;
+        sumAbsVel = s.sumAbsVel;
+        velocityScale = s.velocityScale;
+        maxForce2 = s.maxForce2;
+        maxSpeed2 = s.maxSpeed2;
+        rng.setSeed(s.seed);
+        rngDraws = s.rngDraws;
+        
+        positions.resize(N);
+        velocities.resize(N);
+        forces.resize(N);
+        copyDoubles(positions.x.data(), particles, 0, N);
+        copyDoubles(positions.y.data(), particles, N, N);
+        copyDoubles(velocities.x.data(), particles, 2 * N, N);
+        copyDoubles(velocities.y.data(), particles, 3 * N, N);
+        copyDoubles(forces.x.data(), particles, 4 * N, N);
+        copyDoubles(forces.y.data(), particles, 5 * N, N);
+        
+        slowForcesValid = integrator == RESPA && slow.data;
+        if (slowForcesValid) {
+            slowForces.resize(N);
+            copyDoubles(slowForces.x.data(), slow, 0, N);
+            copyDoubles(slowForces.y.data(), slow, N, N);
+        }
+        
+        gaussians.clear();
+        if (gaussianSection.data) {
+            for (std::uint32_t i = 0; i < gaussianSection.header.count; ++i) {
+                double g[4];
+                copyDoubles(g, gaussianSection, 4 * i, 4);
+                gaussians.push_back(Gaussian(g[0], g[1], g[2], g[3]));
+            }
+        }
+        
+        std::vector <cubic::Point> points;
+        if (splineSection.data) {
+            for (std::uint32_t i = 0; i < splineSection.header.count; ++i) {
+                double p[3];
+                copyDoubles(p, splineSection, 3 * i, 3);
+                points.push_back({p[0], p[1], p[2]});
+            }
+        }
+        customPotential.updatePoints(points);
+        
+        setPotential((Potential)s.potential);
+        TableInterpolation interpolation = s.tableInterpolation == TABLE_LINEAR ? TABLE_LINEAR
+            : s.tableInterpolation == TABLE_CUBIC ? TABLE_CUBIC : TABLE_AUTO;
+        setTabulated(s.tabulated != 0, interpolation, s.tableSize > 0 ? s.tableSize : 4096);
+        
+        restoreWindow(prevEPot, sections[checkpoint::EPOT_HISTORY]);
+        restoreWindow(prevEKin, sections[checkpoint::EKIN_HISTORY]);
+        restoreWindow(prevDt, sections[checkpoint::DT_HISTORY]);
+        
+        prevPositions.clear();
+        speedHistory.clear();
+        speedCountsFresh = false;
+        listValid = false;
+        fastListValid = false;
+        resetStepStats();
+        
+        return true;
+    }
+}
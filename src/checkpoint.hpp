@@ -0,0 +1,106 @@
+/*
+ Argon
+ 
+ Copyright (c) 2016 David McDonagh, Robert Shaw, Staszek Welsh
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+// The binary checkpoint format, written by MDContainer::saveCheckpoint and read by
+// MDContainer::loadCheckpoint, which are in checkpoint.cpp
+//
+// A checkpoint is a Header followed by nSections sections. Each section is a SectionHeader and
+// then size bytes of data, padded with zeros to a multiple of 8 bytes, so that every array of
+// doubles starts 8-byte aligned and can be copied straight out of the memory-mapped file. The
+// arrays are copied into the system's own aligned arrays rather than used in place, as the file is
+// unmapped once it has been read, and the particle arrays have to be able to grow. Numbers
+// are stored in the byte order of the machine which wrote the file, which is checked on loading.
+//
+// Sections which the reader does not know are skipped, so sections can be added without changing
+// VERSION; it only needs to go up if the layout of an existing section changes.
+
+#ifndef checkpoint_hpp
+#define checkpoint_hpp
+
+#include <cstdint>
+
+namespace md {
+namespace checkpoint {
+    
+    const char MAGIC[8] = {'A', 'R', 'G', 'O', 'N', 'C', 'K', 'P'};
+    const std::uint32_t VERSION = 1;
+    const std::uint32_t ENDIAN_CHECK = 0x01020304; // reads as 0x04030201 with the other byte order
+    
+    // Largest energy history capacity and potential table size accepted on loading, so that a
+    // corrupt file cannot ask for a huge allocation
+    const std::uint32_t MAX_HISTORY = 1 << 20;
+    const std::int32_t MAX_TABLE_SIZE = 1 << 20;
+    
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+        std::uint64_t nSections;
+    };
+    
+    struct SectionHeader
+    {
+        std::uint32_t tag;   // one of Tag
+        std::uint32_t count; // number of items in the section, as given for each Tag
+        std::uint64_t size;  // size of the data in bytes, not including the padding
+    };
+    
+    enum Tag
+    {
+        SETTINGS = 1,       // a Settings, count 1
+        PARTICLES = 2,      // count N: x then y of the positions, velocities and forces, N doubles each
+        SLOW_FORCES = 3,    // count N: x then y of the slow RESPA forces, if they are up to date
+        GAUSSIANS = 4,      // count n: amplitude, alpha, x0, y0 of each Gaussian, as doubles
+        SPLINE_POINTS = 5,  // count n: x, y, slope of each custom potential control point, as doubles
+        EPOT_HISTORY = 6,   // count = capacity of the window: the stored values as doubles, oldest first
+        EKIN_HISTORY = 7,
+        DT_HISTORY = 8,
+        N_TAGS
+    };
+    
+    // Everything in an MDContainer which is a single number; the 4-byte fields come in pairs so
+    // that there is no padding in the struct, and it has the same layout with any compiler
+    struct Settings
+    {
+        std::int32_t N, NAfterReset;
+        std::int32_t running, stepsPerUpdate;
+        std::int32_t potential, integrator;      // a Potential and an Integrator
+        std::int32_t tabulated, tableInterpolation;
+        std::int32_t tableSize, respaSteps;
+        std::int32_t adaptiveDt, unused;
+        std::uint64_t seed, rngDraws;
+        double boxWidth, boxHeight;
+        double rcutoff, skin;
+        double dt, fixedDt;
+        double T, freq;
+        double dtMin, dtMax, maxStep, dtGrowth, dtShrink;
+        double respaSplit;
+        double epot, ekin, v_avg, sumAbsVel;
+        double velocityScale, maxForce2, maxSpeed2;
+    };
+}
+}
+
+#endif /* checkpoint_hpp */
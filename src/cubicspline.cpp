@@ -104,6 +104,21 @@ namespace cubic {
         
         return slope;
     }
+    
+    // Returns both y(x) and y'(x), calculating t and the cubic term once
+    void Segment::valueSlope(double x, double &value, double &slope) const {
+        double t = (x - x0) / dx;
+        double omt = 1 - t;
+        double cubic = a * omt + b * t;
+        
+        value = omt * y0 + t * y1;
+        value += t * omt * cubic;
+        
+        slope = y1 - y0;
+        slope += (omt - t) * cubic;
+        slope += t * omt * (b - a);
+        slope /= dx;
+    }
 
     // Moves the left-hand control point to a position/slope defined by target
     void Segment::moveLeft(const Point &target) {
@@ -136,6 +151,7 @@ namespace cubic {
     Spline::Spline(){
         spline.clear();
         spline.push_back(Segment(0,0,1,2,0,1));
+        updateBreaks();
     }
     
     // Create a new Spline with one segment
@@ -148,22 +164,25 @@ namespace cubic {
         } else {
             spline.push_back(Segment(x1, y1, m1, x0, y0, m0));
         }
+        updateBreaks();
     }
 
     // Returns the index in the vector of Segments corresponding to the
     // segment containing x
     int Spline::getSegment(double x) const {
-        int index;
-        
-        // loop through the spline segments
-        // stop when we've gone past x
-        
-        for (index = 1; index < spline.size(); ++index) {
-            if (spline[index].left().x > x) { break; }
-        }
+        // binary search for the first segment after the first which starts past x
+        std::vector<double>::const_iterator it = std::upper_bound(breaks.begin() + 1, breaks.end(), x);
         
         // we've gone past x, so return the index containing x
-        return index - 1;
+        return (it - breaks.begin()) - 1;
+    }
+    
+    // Store the left-hand x of every segment
+    void Spline::updateBreaks() {
+        breaks.resize(spline.size());
+        for (int i = 0; i < spline.size(); ++i) {
+            breaks[i] = spline[i].left().x;
+        }
     }
 
     int Spline::segments() const { return spline.size(); }
@@ -201,6 +220,7 @@ namespace cubic {
         for (int i = 0; i < vec.size() - 1; ++i) {
             spline.push_back(Segment(vec[i], vec[i+1]));
         }
+        updateBreaks();
     }
     
     // reconstructs the internal vector so that all the segments are in left-to-right order
@@ -239,6 +259,7 @@ namespace cubic {
             Segment seg = Segment(l_point, r_point);
             spline.insert(spline.begin() + index, seg);
         }
+        updateBreaks();
     }
 
     // remove a specified control point
@@ -255,6 +276,7 @@ namespace cubic {
             // Then remove segment
             spline.erase(spline.begin() + index);
         }
+        updateBreaks();
     }
 
     // move a specified point to a new position
@@ -294,4 +316,10 @@ namespace cubic {
         int index = getSegment(x);
         return spline[index].slope(x);
     }
+    
+    // return both y(x) and y'(x), looking up the segment only once
+    void Spline::valueSlope(double x, double &value, double &slope) const {
+        int index = getSegment(x);
+        spline[index].valueSlope(x, value, slope);
+    }
 }
@@ -82,6 +82,7 @@ namespace cubic {
         bool  inside(double x) const;  // true if x is between the left and right endpoints
         double value(double x) const;   // value of segment at position x, i.e. returns y(x)
         double slope(double x) const;   // slope of segment at position x, i.e. returns y'(x)
+        void valueSlope(double x, double &value, double &slope) const; // both at once, sharing the work
         
         void moveLeft( const Point &target); // move left endpoint
         void moveRight(const Point &target); // move right endpoint
@@ -94,7 +95,9 @@ namespace cubic {
             This is effectively just a container for multiple Segments. The intended use is to intialise the class
             by defining the start and end points, and then use addPoint to add extra control points.
          
-            The segments are stored within the vector spline in order of increasing x.
+            The segments are stored within the vector spline in order of increasing x. The x position of the
+            left-hand end of each segment is also kept in the sorted vector breaks, so that the segment containing
+            x can be found by binary search, without having to work out every segment's left-hand point.
          */
         
     private:
@@ -102,7 +105,11 @@ namespace cubic {
         // private function since the segments in the spline aren't exposed to the user
         int getSegment(double x) const;
         
+        // rebuild breaks from the segments, to be called whenever the segments change
+        void updateBreaks();
+        
         std::vector <Segment> spline;
+        std::vector <double> breaks; // left-hand x of each segment, in increasing order
         
     public:
         // Default constructor
@@ -124,6 +131,7 @@ namespace cubic {
         bool   inside(double x) const; // true if x is between the left and right endpoints
         double value(double x)  const; // value of the spline at position x, i.e. returns y(x)
         double slope(double x)  const; // slope of the spline at position x, i.e. returns y'(x)
+        void valueSlope(double x, double &value, double &slope) const; // both at once, with one segment lookup
         
         // get vector of control points
         std::vector <Point> getPoints() const;
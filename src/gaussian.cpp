@@ -56,6 +56,12 @@ double Gaussian::getgAmp()   const { return gAmp; }
 double Gaussian::getgex0()   const { return gex0; }
 double Gaussian::getgey0()   const { return gey0; }
 
+// CUTOFF_WIDTHS^2 / gAlpha, or infinite if gAlpha is not positive
+double Gaussian::getCutoff2() const {
+    if (gAlpha <= 0) { return INFINITY; }
+    return CUTOFF_WIDTHS * CUTOFF_WIDTHS / gAlpha;
+}
+
 /*
     ROUTINE setParams:
         Sets each private variable, var, of the class, as:  var = _var
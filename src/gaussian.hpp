@@ -54,6 +54,13 @@ public:
     // Set the parameters
     void setParams(double _gAmp, double _gAlpha, double _gex0, double _gey0);
     
+    // Number of widths (1/sqrt(gAlpha)) from the centre beyond which the Gaussian is treated as
+    // zero; the potential has fallen by a factor of exp(-25) there
+    constexpr static const double CUTOFF_WIDTHS = 5.0;
+    
+    // Square of the distance from the centre beyond which the Gaussian is zero
+    double getCutoff2() const;
+    
     // Calculate the force vector at (x, y) due to the Gaussian
     std::vector<double> calcForceEnergy(double x, double y);
     void calcForceEnergy(double x, double y, std::array<double, 3> &forceEnergy);
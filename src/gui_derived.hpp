@@ -27,6 +27,7 @@
 
 #include <ios>
 #include <functional>
+#include <deque>
 #include "gui_base.hpp"
 #include "mdforces.hpp"
 #include "potentials.hpp"
@@ -389,6 +390,9 @@ namespace gui {
         // sets the potential, calling system.setPotential and setting things visible/invisible as needed
         void setPotential(Potential potential);
         
+        // match the selected potential and the spline points to the system, e.g. after it is loaded
+        void syncWithSystem();
+        
         virtual void setVisible(bool visible);
     };
     
@@ -536,10 +540,7 @@ namespace gui {
         
     private:
         md::MDContainer& theSystem;
-        int numBins;                               // number of M-B bins
-        int numPrevMB;                             // number of timesteps to average over
         double maxHeight;                          // the current peak maximum
-        std::deque <std::vector <double>> prevMB;  // vector of previous M-B distributions
         
         virtual void render();
         
@@ -617,6 +618,9 @@ namespace gui {
         
         // reset the entire spline
         void destroyAllPoints();
+        
+        // replace the control points with those of the system's custom potential
+        void syncWithSystem();
     };
     
     class GaussianContainer : public UIContainer
@@ -665,6 +669,9 @@ namespace gui {
         
         // remove all Gaussians
         void destroyAllGaussians();
+        
+        // replace the Gaussian atoms with one for each Gaussian in the system
+        void syncWithSystem();
     };
     
     // Main container to manage all tutorial events
@@ -120,6 +120,11 @@ namespace gui {
         }
     }
     
+    void PotentialContainer::syncWithSystem() {
+        setPotential(theSystem.getPotential().getType());
+        ((SplineContainer *)getChild(splineContainerIndex))->syncWithSystem();
+    }
+    
     /*
         PotentialAtom
      */
@@ -133,6 +138,7 @@ namespace gui {
     
     void PotentialAtom::render() {
         PotentialFunctor &pot = theSystem.getPotential();
+        const md::Snapshot& snapshot = theSystem.getSnapshot();
         std::vector<coord> potPoints, particlePoints;
         
         double x, y;
@@ -140,15 +146,15 @@ namespace gui {
         
         // Set up particle separations, relative to particle N/2, which
         // is hopefully roughly in the centre of the system
-        int posRelIndex = theSystem.getN() / 2;
-        coord posRel = theSystem.getPos(posRelIndex);
+        int posRelIndex = snapshot.getN() / 2;
+        coord posRel = snapshot.getPos(posRelIndex);
         
         // put all particle positions into particlePoints
         coord pos;
-        for (int i = 0; i < theSystem.getN(); i++){
+        for (int i = 0; i < snapshot.getN(); i++){
             if (i == posRelIndex) { continue; }
             
-            pos = theSystem.getPos(i);
+            pos = snapshot.getPos(i);
             x = pos.x - posRel.x;
             y = pos.y - posRel.y;
             pos.x = sqrt(x*x + y*y);
@@ -184,7 +190,7 @@ namespace gui {
         // Plot the RDF
         rect RDFspace;
         RDFspace.setLRTB(0, numBins, 5.0 / numBins, 0);
-        prevRDF.push_back(theSystem.rdf(potBounds.left, potBounds.right, numBins));
+        prevRDF.push_back(snapshot.rdf(potBounds.left, potBounds.right, numBins));
         while (prevRDF.size() > numPrevRDF) {
             prevRDF.pop_front();
         }
@@ -468,4 +474,19 @@ namespace gui {
         children.clear();
         updateSpline();
     }
+    
+    // the spline is already set in the system, so the points are only made to match it
+    void SplineContainer::syncWithSystem() {
+        for (int i = 0; i < children.size(); ++i) {
+            delete children[i];
+        }
+        children.clear();
+        
+        const std::vector <cubic::Point> &points = system.getCustomPotential().getPoints();
+        for (int i = 0; i < points.size(); ++i) {
+            coord pos = util::bimap(coord(points[i].x, points[i].y), splineRegion, bounds);
+            children.push_back(new SplineControlPoint(pos.x, pos.y, radius, pointRegion));
+            ((SplineControlPoint *)children.back())->m = points[i].m;
+        }
+    }
 }
@@ -55,12 +55,15 @@ namespace gui {
         ArgonImage* leftImage = inflictTorture ? &loganLeft : &boatLeft;
         ArgonImage* rightImage = inflictTorture ? &loganRight : &boatRight;
         
-        double v_avg = theSystem.getVAvg(); // Get average velocity for scaling purposes
+        // Draw from the latest snapshot of the system
+        const md::Snapshot& snapshot = theSystem.getSnapshot();
+        
+        double v_avg = snapshot.getVAvg(); // Get average velocity for scaling purposes
         
         // Draw all the particles and trails
-        for (int i = 0; i < theSystem.getN(); ++i) {
-            tempVel = theSystem.getVel(i);
-            tempAcc = theSystem.getForce(i);
+        for (int i = 0; i < snapshot.getN(); ++i) {
+            tempVel = snapshot.getVel(i);
+            tempAcc = snapshot.getForce(i);
             
             hue = util::map(fabs(tempVel.x) + fabs(tempVel.y), 0, 3 * v_avg, 170, 210, true);
             particleColor.setHSB(hue, 255, 255);
@@ -70,7 +73,7 @@ namespace gui {
             radius = (radius_x + radius_y) / 2;
             
             if (inflictTorture || setSail) {
-                coord screenpos = util::bimap(theSystem.getPos(i), theSystem.getBox(), windowSize());
+                coord screenpos = util::bimap(snapshot.getPos(i), snapshot.getBox(), windowSize());
                 rect drawpos;
                 drawpos.setXYWH(screenpos.x - loganShiftx, screenpos.y - loganShifty, radius_x * 4, radius_y * 4);
                 if (tempVel.x >= 0)
@@ -81,15 +84,15 @@ namespace gui {
                     leftImage->draw(drawpos, particleColor);
             } else {
                 //trail
-                if (theSystem.getNPrevPos() >= 15) {
+                if (snapshot.getNPrevPos() >= 15) {
                     particleColor.a = 100;
                     drawParticle(i, radius * 0.25, particleColor, 14);
                 }
-                if (theSystem.getNPrevPos() >= 10) {
+                if (snapshot.getNPrevPos() >= 10) {
                     particleColor.a = 150;
                     drawParticle(i, radius * 0.5,  particleColor, 9);
                 }
-                if (theSystem.getNPrevPos() >= 5) {
+                if (snapshot.getNPrevPos() >= 5) {
                     particleColor.a = 200;
                     drawParticle(i, radius * 0.75, particleColor, 4);
                 }
@@ -110,13 +113,15 @@ namespace gui {
      Optional: draws the particle with position nframes frames in the past
      */
     void SystemAtom::drawParticle(int index, double radius_x, double radius_y, RGB colour, int nframes, int resolution) {
-        coord screenpos = util::bimap(theSystem.getPos(index, nframes), theSystem.getBox(), windowSize());
+        const md::Snapshot& snapshot = theSystem.getSnapshot();
+        coord screenpos = util::bimap(snapshot.getPos(index, nframes), snapshot.getBox(), windowSize());
         drawEllipse(screenpos.x, screenpos.y, radius_x, radius_y, colour, resolution);
 
     }
     
     void SystemAtom::drawParticle(int index, double radius, RGB colour, int nframes, int resolution) {
-        coord screenpos = util::bimap(theSystem.getPos(index, nframes), theSystem.getBox(), windowSize());
+        const md::Snapshot& snapshot = theSystem.getSnapshot();
+        coord screenpos = util::bimap(snapshot.getPos(index, nframes), snapshot.getBox(), windowSize());
         drawCircle(screenpos.x, screenpos.y, radius, colour, resolution);
     }
 
@@ -144,11 +149,13 @@ namespace gui {
          as the minimum/maximum values respectively.
          */
         
-        int numPoints = theSystem.getNEnergies();
+        const md::Snapshot& snapshot = theSystem.getSnapshot();
+        const util::SlidingWindow& ekinHistory = snapshot.getEkinHistory();
+        const util::SlidingWindow& epotHistory = snapshot.getEpotHistory();
         
         // max and min of potential and kinetic energies
-        double top    = std::max(theSystem.getMaxEkin(), theSystem.getMaxEpot());
-        double bottom = std::min(theSystem.getMinEkin(), theSystem.getMinEpot());
+        double top    = std::max(snapshot.getMaxEkin(), snapshot.getMaxEpot());
+        double bottom = std::min(snapshot.getMinEkin(), snapshot.getMinEpot());
         
         // ensure that zero is drawn
         top    = top    > 0 ? top : 0;
@@ -160,18 +167,21 @@ namespace gui {
         }
         
         rect energySpace;
-        energySpace.setLRTB(0, 119, top, bottom); // 119 is max number of energy points - 1
+        energySpace.setLRTB(0, std::max(ekinHistory.getCapacity() - 1, 1), top, bottom);
+        
+        // at most a minimum and maximum per pixel column are drawn, however long the history
+        int buckets = std::max((int)bounds.width(), 1);
+        std::vector <coord> ekinPoints = ekinHistory.downsample(buckets);
+        std::vector <coord> epotPoints = epotHistory.downsample(buckets);
         
         coord point;
         ArgonMesh Ekin, Epot;
-        for (int i = 0; i < numPoints; ++i) {
-            point = {(double)i, theSystem.getPreviousEkin(i)};
-            point = util::bimap(point, energySpace, bounds);
+        for (int i = 0; i < ekinPoints.size(); ++i) {
+            point = util::bimap(ekinPoints[i], energySpace, bounds);
             Ekin.addVertex(point.x, point.y);
-            
-            //ofSetColor(255, 255, 255); not sure if this does anything..but commenting out for now in case it does
-            point = {(double)i, theSystem.getPreviousEpot(i)};
-            point = util::bimap(point, energySpace, bounds);
+        }
+        for (int i = 0; i < epotPoints.size(); ++i) {
+            point = util::bimap(epotPoints[i], energySpace, bounds);
             Epot.addVertex(point.x, point.y);
         }
        
@@ -198,40 +208,31 @@ namespace gui {
         MaxwellGraphAtom
      */
     
-    MaxwellGraphAtom::MaxwellGraphAtom(md::MDContainer& _theSystem, int x, int y, int width, int height) : theSystem(_theSystem), UIAtom(x, y, width, height), numBins(100), numPrevMB(40), maxHeight(0.1), prevMB() {}
+    MaxwellGraphAtom::MaxwellGraphAtom(md::MDContainer& _theSystem, int x, int y, int width, int height) : theSystem(_theSystem), UIAtom(x, y, width, height), maxHeight(0.1) {}
     
     void MaxwellGraphAtom::render() {
         /*
-         Draws the Maxwell-Boltzmann distribution.
+         Draws the Maxwell-Boltzmann distribution, averaged over the last few updates of the
+         system, which keeps the average up to date as it runs.
          */
         
-        double maxSpeed = 10;
+        const std::vector <double>& distribution = theSystem.getSnapshot().getSpeedDistribution();
+        int numBins = distribution.size();
         
         rect maxwellSpace;
         maxwellSpace.setLRTB(0, numBins, maxHeight, 0);
         
-        prevMB.push_back(theSystem.maxwell(0, maxSpeed, numBins));
-        while (prevMB.size() > numPrevMB) {
-            prevMB.pop_front();
-        }
-        
         coord point;
         ArgonMesh MBcurve;
         MBcurve.addVertex(bounds.left, bounds.bottom);
         double currMaxHeight = 0.0;
         
         for (int i = 0; i < numBins; ++i) {
-            double sum = 0.0;
-            for (int j = 0; j < prevMB.size(); ++j) {
-                sum += prevMB[j][i];
-            }
-            sum /= prevMB.size();
-            
-            point = {(double)i + 0.5, sum};
+            point = {(double)i + 0.5, distribution[i]};
             point = util::bimap(point, maxwellSpace, bounds);
             MBcurve.addVertex(point.x, point.y);
             
-            currMaxHeight = sum > currMaxHeight ? sum : currMaxHeight;
+            currMaxHeight = distribution[i] > currMaxHeight ? distribution[i] : currMaxHeight;
         }
         
         maxHeight = currMaxHeight > 0.1 ? currMaxHeight : 0.1;
@@ -576,5 +577,22 @@ namespace gui {
         children.clear();
         selectedGaussian = -1;
     }
+    
+    void GaussianContainer::syncWithSystem() {
+        for (int i = 0; i < children.size(); ++i) {
+            delete children[i];
+        }
+        children.clear();
+        selectedGaussian = -1;
+        
+        // Rescale the centres from the box to the window
+        double xscale = windowWidth() / system.getWidth();
+        double yscale = windowHeight() / system.getHeight();
+        for (int i = 0; i < system.getNGaussians(); ++i) {
+            int x = system.getGaussianX0(i) * xscale;
+            int y = system.getGaussianY0(i) * yscale;
+            children.push_back(new GaussianAtom(system, circGradient, i, uiFont10, closeButton, audioOnButton, audioOffButton, x, y, radius));
+        }
+    }
 
 }
@@ -23,29 +23,206 @@
  */
 
 #include "mdforces.hpp"
+#include "trajectory.hpp"
 #include <cmath> // Basic maths functions
 #include <random> // For the Andersen thermostat
-#include <thread> // For multithreading
 #include <iostream>
 #include <algorithm>
+#include <chrono> // For timing the threads
 
 namespace md {
+    
+    //----------------------PARTICLE ARRAYS------------------------
+    
+    int ParticleArray::size() const { return x.size(); }
+    
+    void ParticleArray::resize(int n) {
+        x.resize(n);
+        y.resize(n);
+    }
+    
+    void ParticleArray::clear() {
+        x.clear();
+        y.clear();
+    }
+    
+    coord ParticleArray::get(int i) const { return coord(x[i], y[i]); }
+    
+    void ParticleArray::set(int i, coord value) {
+        x[i] = value.x;
+        y[i] = value.y;
+    }
+    
+    void ParticleArray::push_back(coord value) {
+        x.push_back(value.x);
+        y.push_back(value.y);
+    }
+    
+    void ParticleArray::pop_back() {
+        x.pop_back();
+        y.pop_back();
+    }
+    
+    //----------------------TRAIL HISTORY--------------------------
+    
+    TrailHistory::TrailHistory(int _capacity) : capacity(0), count(0), head(0), width(0), pushes(0), resets(0) {
+        setCapacity(_capacity);
+    }
+    
+    int TrailHistory::getCapacity() const { return capacity; }
+    
+    void TrailHistory::setCapacity(int _capacity) {
+        capacity = _capacity > 0 ? _capacity : 1;
+        frameN.assign(capacity, 0);
+        x.resize(capacity * width);
+        y.resize(capacity * width);
+        clear();
+    }
+    
+    int TrailHistory::size() const { return count; }
+    
+    void TrailHistory::clear() {
+        count = 0;
+        head = 0;
+        ++resets;
+    }
+    
+    int TrailHistory::slot(int nstep) const { return (head - nstep + capacity) % capacity; }
+    
+    // Copy the positions into the slot after head
+    // if there are more particles than the slots have room for, the slots are widened, keeping
+    // the stored frames; this is the only time memory is allocated
+    void TrailHistory::push(const ParticleArray &positions) {
+        int n = positions.size();
+        if (n > width) {
+            int newWidth = std::max(n, 2 * width);
+            AlignedArray newx(capacity * newWidth), newy(capacity * newWidth);
+            for (int s = 0; s < capacity; ++s) {
+                std::copy(x.begin() + s * width, x.begin() + s * width + frameN[s], newx.begin() + s * newWidth);
+                std::copy(y.begin() + s * width, y.begin() + s * width + frameN[s], newy.begin() + s * newWidth);
+            }
+            x.swap(newx);
+            y.swap(newy);
+            width = newWidth;
+            ++resets;
+        }
+        
+        head = (head + 1) % capacity;
+        std::copy(positions.x.begin(), positions.x.end(), x.begin() + head * width);
+        std::copy(positions.y.begin(), positions.y.end(), y.begin() + head * width);
+        frameN[head] = n;
+        if (count < capacity) { ++count; }
+        ++pushes;
+    }
+    
+    bool TrailHistory::has(int i, int nstep) const {
+        return nstep < count && i < frameN[slot(nstep)];
+    }
+    
+    coord TrailHistory::get(int i, int nstep) const {
+        int s = slot(nstep);
+        return coord(x[s * width + i], y[s * width + i]);
+    }
+    
+    // Copy the newest frames of source into the same slots here
+    // both have seen the same clears and resizes if resets, capacity and width all match, so the
+    // frames they have in common are in the same slots
+    void TrailHistory::copyNewFrames(const TrailHistory &source) {
+        std::uint64_t nnew = source.pushes - pushes;
+        if (resets != source.resets || capacity != source.capacity || width != source.width
+            || source.pushes < pushes || nnew > (std::uint64_t)capacity) {
+            *this = source;
+            return;
+        }
+        
+        for (int nstep = 0; nstep < (int)nnew; ++nstep) {
+            int s = source.slot(nstep);
+            std::copy(source.x.begin() + s * width, source.x.begin() + s * width + source.frameN[s], x.begin() + s * width);
+            std::copy(source.y.begin() + s * width, source.y.begin() + s * width + source.frameN[s], y.begin() + s * width);
+            frameN[s] = source.frameN[s];
+        }
+        count = source.count;
+        head = source.head;
+        pushes = source.pushes;
+    }
+    
+    //----------------------SNAPSHOTS----------------------------
+    
+    Snapshot::Snapshot() : N(0), box(0, 0), epot(0), ekin(0), v_avg(0) {}
+    
+    int    Snapshot::getN()      const { return N; }
+    coord  Snapshot::getBox()    const { return box; }
+    double Snapshot::getWidth()  const { return box.x; }
+    double Snapshot::getHeight() const { return box.y; }
+    double Snapshot::getVAvg()   const { return v_avg; }
+    
+    coord Snapshot::getPos(int i)   const { return positions.get(i); }
+    coord Snapshot::getVel(int i)   const { return velocities.get(i); }
+    coord Snapshot::getForce(int i) const { return forces.get(i); }
+    
+    coord Snapshot::getPos(int i, int nstep) const {
+        return prevPositions.has(i, nstep) ? prevPositions.get(i, nstep) : positions.get(i);
+    }
+    int Snapshot::getNPrevPos() const { return prevPositions.size(); }
+    
+    double Snapshot::getEPot()    const { return epot; }
+    double Snapshot::getEKin()    const { return ekin; }
+    double Snapshot::getMaxEpot() const { return prevEPot.getMax(); }
+    double Snapshot::getMaxEkin() const { return prevEKin.getMax(); }
+    double Snapshot::getMinEpot() const { return prevEPot.getMin(); }
+    double Snapshot::getMinEkin() const { return prevEKin.getMin(); }
+    const util::SlidingWindow& Snapshot::getEpotHistory() const { return prevEPot; }
+    const util::SlidingWindow& Snapshot::getEkinHistory() const { return prevEKin; }
+    const std::vector <double>& Snapshot::getSpeedDistribution() const { return speedDistribution; }
+    
+    std::vector <double> Snapshot::rdf(double min, double max, int bins) const {
+        return separationHistogram(positions, N, min, max, bins);
+    }
+    std::vector <double> Snapshot::maxwell(double min, double max, int bins) const {
+        return speedHistogram(velocities, N, min, max, bins);
+    }
+    
 
     /*
         DEFAULT CONSTRUCTOR:
             Initially sets the box dimensions to 10 x 10, the rcutoff to 3, the
-            timestep to 0.002, and the thermostat frequency to 0.1.
+            neighbour list skin to 0.3, the timestep to 0.002, and the thermostat frequency to 0.1.
             Initialises maximum energies to zero, and starts system as running.
      */
     MDContainer::MDContainer()
     {
         box_dimensions = {10, 10};
         rcutoff = 3.0;
-        dt = 0.002;
+        skin = 0.3;
+        dt = fixedDt = 0.002;
+        adaptiveDt = false;
+        dtMin = 0.0005;
+        dtMax = 0.008;
+        maxStep = 0.015;
+        dtGrowth = 1.05;
+        dtShrink = 0.5;
+        maxForce2 = maxSpeed2 = -1.0;
+        resetStepStats();
         freq = 0.1;
-        maxEKin = 0.0;
-        maxEPot = 0.0;
+        ncellx = ncelly = 1;
+        listValid = false;
+        fullList = false;
+        fastListValid = false;
+        nRebuilds = nListSteps = 0;
+        velocityScale = 1.0;
+        sumAbsVel = 0.0;
+        v_avg = 0.0;
+        rng.setSeed(std::random_device()()); // a different run every time, unless setSeed is called
+        rngDraws = 0;
         potential = &lj;
+        setPairForces<LennardJones>();
+        integrator = VELOCITY_VERLET;
+        respaSteps = 4;
+        respaSplit = 2.0;
+        slowForcesValid = false;
+        speedHistMax = 10.0;
+        speedCountsFresh = false;
+        trajectory = nullptr;
         running = true;
     }
     
@@ -62,10 +239,17 @@ namespace md {
         prevPositions.clear();
         prevEKin.clear();
         prevEPot.clear();
+        prevDt.clear();
+        speedHistory.clear();
+        speedCountsFresh = false;
         N = 0;
+        maxForce2 = maxSpeed2 = -1.0;
+        velocityScale = 1.0;
+        slowForcesValid = false;
+        resetStepStats();
         
         addParticlesGrid(NAfterReset);
-        forcesEnergies(1); // one thread
+        forcesEnergies(pool.getNThreads()); // as many threads as the last step
         savePreviousValues();
     }
     
@@ -83,14 +267,15 @@ namespace md {
     double MDContainer::getVAvg()           const { return v_avg; }
     double MDContainer::getTimestep()       const { return dt; }
     double MDContainer::getCutoff()         const { return rcutoff; }
+    double MDContainer::getSkin()           const { return skin; }
     coord  MDContainer::getBox()            const { return box_dimensions; }
     double MDContainer::getWidth()          const { return box_dimensions.x; }
     double MDContainer::getHeight()         const { return box_dimensions.y; }
     double MDContainer::getFreq()           const { return freq; }
-    double MDContainer::getMaxEkin()        const { return maxEKin; }
-    double MDContainer::getMaxEpot()        const { return maxEPot; }
-    double MDContainer::getMinEkin()        const { return minEKin; }
-    double MDContainer::getMinEpot()        const { return minEPot; }
+    double MDContainer::getMaxEkin()        const { return prevEKin.getMax(); }
+    double MDContainer::getMaxEpot()        const { return prevEPot.getMax(); }
+    double MDContainer::getMinEkin()        const { return prevEKin.getMin(); }
+    double MDContainer::getMinEpot()        const { return prevEPot.getMin(); }
     
     // Return sizes of gaussians, prevPos, and energies vectors, i.e. the number
     // of gaussians, positions and energies stored
@@ -98,18 +283,83 @@ namespace md {
     int MDContainer::getNEnergies()         const { return prevEKin.size(); }
     int MDContainer::getNPrevPos()          const { return prevPositions.size(); }
     
+    // Return the number of neighbour list rebuilds, and the number of force calculations
+    // over which they happened; their ratio shows how well the skin is chosen
+    int MDContainer::getNRebuilds()         const { return nRebuilds; }
+    int MDContainer::getNListSteps()        const { return nListSteps; }
+    void MDContainer::resetListStats() { nRebuilds = nListSteps = 0; }
+    
+    // A full list stores every pair twice, once under each particle
+    int MDContainer::getNListPairs() const { return fullList ? neighbourList.size() / 2 : neighbourList.size(); }
+    
+    // Return the time in seconds taken by each thread in the last force calculation
+    int    MDContainer::getNThreadTimes()     const { return threadTimes.size(); }
+    double MDContainer::getThreadTime(int t)  const { return threadTimes[t]; }
+    
+    // Return the time taken by the slowest thread divided by the mean time per thread
+    double MDContainer::getLoadImbalance() const {
+        double total = 0.0, slowest = 0.0;
+        for (std::size_t t = 0; t < threadTimes.size(); ++t) {
+            total += threadTimes[t];
+            slowest = std::max(slowest, threadTimes[t]);
+        }
+        return total > 0 ? slowest * threadTimes.size() / total : 1.0;
+    }
+    
+    const ParticleArray& MDContainer::getPositions()  const { return positions; }
+    const ParticleArray& MDContainer::getVelocities() const { return velocities; }
+    
     // Return (x, y) vectors of the dynamical variables of particle i
     // Safety checks could be added, but index checking is usually slow
-    coord MDContainer::getPos(int i)        const { return positions[i]; }
-    coord MDContainer::getVel(int i)        const { return velocities[i]; }
-    coord MDContainer::getForce(int i)      const { return forces[i]; }
+    coord MDContainer::getPos(int i)        const { return positions.get(i); }
+    coord MDContainer::getVel(int i)        const { return velocities.get(i); }
+    coord MDContainer::getForce(int i)      const { return forces.get(i); }
     
     // Return the (x, y) position vector of particle npart, from nstep timesteps previously
-    coord MDContainer::getPos(int npart, int nstep) const { return prevPositions[nstep][npart]; }
+    coord MDContainer::getPos(int npart, int nstep) const {
+        return prevPositions.has(npart, nstep) ? prevPositions.get(npart, nstep) : positions.get(npart);
+    }
     
     // Return the ith previous kinetic and potential energy
-    double MDContainer::getPreviousEkin(int i) const { return prevEKin[i]; }
-    double MDContainer::getPreviousEpot(int i) const { return prevEPot[i]; }
+    double MDContainer::getPreviousEkin(int i) const { return prevEKin.get(i); }
+    double MDContainer::getPreviousTimestep(int i) const { return prevDt.get(i); }
+    double MDContainer::getPreviousEpot(int i) const { return prevEPot.get(i); }
+    
+    const util::SlidingWindow& MDContainer::getEpotHistory() const { return prevEPot; }
+    const util::SlidingWindow& MDContainer::getEkinHistory() const { return prevEKin; }
+    
+    int MDContainer::getEnergyHistoryLength() const { return prevEKin.getCapacity(); }
+    
+    // Snapshots: the writer's copy is filled in with assignments, which reuse its memory once it
+    // is big enough, apart from the trails, where only the frames saved since that copy was last
+    // written are copied
+    void MDContainer::publishSnapshot() {
+        Snapshot &s = snapshots.getBack();
+        s.N = N;
+        s.box = box_dimensions;
+        s.positions = positions;
+        s.velocities = velocities;
+        s.forces = forces;
+        s.prevPositions.copyNewFrames(prevPositions);
+        s.prevEPot = prevEPot;
+        s.prevEKin = prevEKin;
+        s.epot = epot;
+        s.ekin = ekin;
+        s.v_avg = v_avg;
+        if (speedHistory.size() > 0) {
+            s.speedDistribution = speedHistory.getSum();
+            util::normaliseHistogram(s.speedDistribution);
+        } else {
+            s.speedDistribution = speedHistogram(velocities, N, 0, speedHistMax, speedHistory.getBins());
+        }
+        snapshots.publish();
+    }
+    
+    void MDContainer::setTrajectory(TrajectoryWriter *writer) { trajectory = writer; }
+    TrajectoryWriter* MDContainer::getTrajectory() const { return trajectory; }
+    
+    bool MDContainer::acquireSnapshot() { return snapshots.acquire(); }
+    const Snapshot& MDContainer::getSnapshot() const { return snapshots.getFront(); }
     
     // Return a reference to the ith gaussian in gaussians
     Gaussian& MDContainer::getGaussian(int i) { return gaussians[i]; }
@@ -138,15 +388,15 @@ namespace md {
     // Set the position of particle i to (x, y)
     void MDContainer::setPos(int i, double x, double y)
     {
-        positions[i].x = x;
-        positions[i].y = y;
+        positions.x[i] = x;
+        positions.y[i] = y;
     }
     
     // Set the velocity of particle i to (vx, vy)
     void MDContainer::setVel(int i, double vx, double vy)
     {
-        velocities[i].x = vx;
-        velocities[i].y = vy;
+        velocities.x[i] = vx;
+        velocities.y[i] = vy;
     }
     
     // Set the parameters - the box dimensions, temperature, timestep and
@@ -155,18 +405,50 @@ namespace md {
     // temp     - 0.5 (60K)
     // timestep - 0.002
     // cutoff   - 3
+    // skin     - 0.3 (may also be zero)
+    // Changing the cutoff or skin invalidates the neighbour list
     void MDContainer::setBox(double box_width, double box_length) {
         box_dimensions.x = box_width  > 0 ? box_width  : 10.0;
         box_dimensions.y = box_length > 0 ? box_length : 10.0;
     }
     void MDContainer::setTemp(double temperature) { T = temperature >= 0 ? temperature : 0.5; }
-    void MDContainer::setTimestep(double timestep) { dt = timestep > 0 ? timestep : 0.002; }
-    void MDContainer::setCutoff(double cutoff) { rcutoff = cutoff > 0 ? cutoff : 3.0; }
+    void MDContainer::setTimestep(double timestep) { dt = fixedDt = timestep > 0 ? timestep : 0.002; }
+    void MDContainer::setCutoff(double cutoff) { rcutoff = cutoff > 0 ? cutoff : 3.0; listValid = false; }
+    void MDContainer::setSkin(double _skin) { skin = _skin >= 0 ? _skin : 0.3; listValid = false; }
     void MDContainer::setFreq(double frequency) { freq = frequency >= 0 ? frequency : 0.1; }
     
+    // Set the number of frames kept for trails, which clears the stored frames
+    int MDContainer::getTrailLength() const { return prevPositions.getCapacity(); }
+    void MDContainer::setTrailLength(int nframes) { prevPositions.setCapacity(nframes); }
+    
+    void MDContainer::setEnergyHistoryLength(int nframes) {
+        prevEPot.setCapacity(nframes);
+        prevEKin.setCapacity(nframes);
+        prevDt.setCapacity(nframes);
+    }
+    
+    std::vector <double> MDContainer::getSpeedDistribution() const {
+        if (speedHistory.size() == 0) { return speedHistogram(velocities, N, 0, speedHistMax, speedHistory.getBins()); }
+        return speedHistory.getAverage();
+    }
+    
+    void MDContainer::setSpeedHistogram(double max, int bins, int nframes) {
+        speedHistMax = max > 0 ? max : 10.0;
+        speedHistory.resize(bins, nframes);
+        speedCountsFresh = false;
+    }
+    
+    // Set the seed for the random numbers, restarting the sequence of draws, so that a run can
+    // be repeated exactly
+    void MDContainer::setSeed(std::uint64_t seed) { rng.setSeed(seed); rngDraws = 0; }
+    std::uint64_t MDContainer::getSeed() const { return rng.getSeed(); }
+    
+    // Return the number of a new pair of random draws
+    std::uint64_t MDContainer::nextDraw() { rngDraws += 2; return rngDraws - 2; }
+    
     // Set the potential
     
-    void MDContainer::setPotential(PotentialFunctor* _potential) { potential = _potential; }
+    void MDContainer::setPotential(PotentialFunctor* _potential) { potential = _potential; choosePairForces(); }
     void MDContainer::setPotential(Potential _potential) {
         switch (_potential) {
             case SQUARE_WELL:
@@ -181,6 +463,43 @@ namespace md {
             default:
                 potential = &lj;
         }
+        choosePairForces();
+    }
+    
+    // Switch table mode on or off for all the built-in potentials
+    void MDContainer::setTabulated(bool on, TableInterpolation interpolation, int size) {
+        lj.setTabulated(on, interpolation, size);
+        morse.setTabulated(on, interpolation, size);
+        squareWell.setTabulated(on, interpolation, size);
+        customPotential.setTabulated(on, interpolation, size);
+        choosePairForces();
+    }
+    
+    bool MDContainer::getTabulated() const { return potential->isTabulated(); }
+    
+    // Choose the pair force kernel for the type of the current potential, so that the kernel
+    // calls the potential's own evaluateBlock without going through the vtable
+    // tabulated Lennard-Jones uses the generic kernel, as its own kernel ignores the table
+    // potentials set through a pointer may be any subclass, so also use the generic kernel
+    void MDContainer::choosePairForces() {
+        if (potential == &lj && !lj.isTabulated())
+            setPairForces<LennardJones>();
+        else if (potential == &morse)
+            setPairForces<Morse>();
+        else if (potential == &squareWell)
+            setPairForces<SquareWell>();
+        else if (potential == &customPotential)
+            setPairForces<CustomPotential>();
+        else
+            setPairForces<PotentialFunctor>();
+    }
+    
+    // Point the kernels for each range of pairs at forcesThread for the potential type Functor
+    template <class Functor>
+    void MDContainer::setPairForces() {
+        pairForces[ALL_PAIRS]  = &MDContainer::forcesThread<Functor, ALL_PAIRS>;
+        pairForces[FAST_PAIRS] = &MDContainer::forcesThread<Functor, FAST_PAIRS>;
+        pairForces[SLOW_PAIRS] = &MDContainer::forcesThread<Functor, SLOW_PAIRS>;
     }
     
 /*
@@ -192,28 +511,32 @@ namespace md {
         in the top of the box.
  */
     void MDContainer::addParticlesGrid(int numParticles) {
-        int i = 0, j = 0;
-        double posx, posy;
-        
         double box_ratio = box_dimensions.x / box_dimensions.y;
         int n_grid_x = ceil(sqrt(numParticles * box_ratio));
         int n_grid_y = ceil(sqrt(numParticles / box_ratio));
         double xspacing = box_dimensions.x / n_grid_x;
         double yspacing = box_dimensions.y / n_grid_y;
         
-        // grid particles
-        for (int n = 0; n < numParticles; ++n){
-            coord pos;
-            pos.x = xspacing * (i + 0.5);
-            pos.y = yspacing * (j + 0.5);
-            
-            coord vel = randomVel();
-            
-            addParticle(pos, vel);
-            
-            i = (i + 1) % n_grid_x;
-            if (i == 0) ++j;
-        }
+        // make room for the new particles, with zero initial forces
+        int start = N;
+        N += numParticles;
+        positions.resize(N);
+        velocities.resize(N);
+        forces.resize(N);
+        listValid = false;
+        
+        // grid particles, split over the thread pool
+        std::uint64_t draw = nextDraw();
+        int nthreads = pool.getNThreads();
+        pool.run([&] (int t) {
+            for (int n = numParticles * t / nthreads; n < numParticles * (t + 1) / nthreads; ++n) {
+                int i = n % n_grid_x, j = n / n_grid_x;
+                coord pos(xspacing * (i + 0.5), yspacing * (j + 0.5));
+                
+                positions.set(start + n, pos);
+                velocities.set(start + n, randomVel(start + n, draw));
+            }
+        });
     }
 
     
@@ -236,6 +559,7 @@ namespace md {
         
         // Increment the number of particles
         ++N;
+        listValid = false;
     }
     
     void MDContainer::addParticle(double x, double y, double vx, double vy) {
@@ -259,6 +583,7 @@ namespace md {
             positions.pop_back();
             velocities.pop_back();
             forces.pop_back();
+            listValid = false;
         }
     }
     
@@ -314,166 +639,550 @@ namespace md {
     
     
     /* 
-        ROUTINE externalForces:
-            Loops over all the Gaussians in the gaussians array and calculates the forces on each particle
-            due to each Gaussian (if any exist), and the contribution to the potential energy.
+        ROUTINE externalForce:
+            Loops over all the Gaussians in the gaussians array and calculates the forces on particles
+            start through end due to each Gaussian (if any exist), adding them into target and the
+            contribution to the potential energy to eptemp. Only writes to particles start through end, so threads with
+            different ranges may run at once.
+     
+            The parameters of each Gaussian are unpacked before looping over the particles, and
+            particles more than Gaussian::CUTOFF_WIDTHS widths from the centre are skipped.
      */
-    void MDContainer::externalForce()
+    void MDContainer::externalForce(int start, int end, ParticleArray &target, double &eptemp)
     {
-        std::array<double, 3> forceEnergy; // Temporary array to store force and potential energy
-        double x, y; // Unpack the x and y positions of particle i
+        const double *px = positions.x.data(), *py = positions.y.data();
+        double *fx = target.x.data(), *fy = target.y.data();
         
-        for (int g = 0; g < gaussians.size(); g++){ // Loop over Gaussians
+        for (std::size_t g = 0; g < gaussians.size(); g++){ // Loop over Gaussians
+            double amp = gaussians[g].getgAmp();
+            double alpha = gaussians[g].getgAlpha();
+            double x0 = gaussians[g].getgex0();
+            double y0 = gaussians[g].getgey0();
+            double cut2 = gaussians[g].getCutoff2();
             
-            for (int i = 0; i < N; i++){ // Loop over particles
-                
-                x = positions[i].x;
-                y = positions[i].y;
+            for (int i = start; i < end; i++){ // Loop over particles
+                double dx = px[i] - x0;
+                double dy = py[i] - y0;
+                double d2 = dx * dx + dy * dy;
                 
-                // Calculate the force and energy into forceEnergy
-                // due to Gaussian g at position (x, y)
-                gaussians[g].calcForceEnergy(x, y, forceEnergy);
-                
-                // Update forces on particle i
-                forces[i].x += forceEnergy[0];
-                forces[i].y += forceEnergy[1];
-                
-                // Update potential energy
-                epot += forceEnergy[2];
+                if (d2 < cut2) {
+                    // Energy, and force = -grad(energy)
+                    double e = amp * exp(-alpha * d2);
+                    fx[i] -= 2 * alpha * dx * e;
+                    fy[i] -= 2 * alpha * dy * e;
+                    eptemp += e;
+                }
+            }
+        }
+    }
+    
+    /*
+        ROUTINE buildCells:
+            Sorts the particles into a grid of cells, each at least rlist wide and high, so that
+            any pair of particles within rlist of each other is in the same or neighbouring cells.
+     
+            The cells are stored as linked lists: cellHead[c] is the first particle in cell c, and
+            cellNext[i] is the particle after i in the same cell, with -1 marking the end of a list.
+            Particles outside of the box are clamped into the edge cells, which keeps the search correct.
+     */
+    void MDContainer::buildCells(double rlist)
+    {
+        ncellx = std::max(1, (int)(box_dimensions.x / rlist));
+        ncelly = std::max(1, (int)(box_dimensions.y / rlist));
+        cell_dimensions.x = box_dimensions.x / ncellx;
+        cell_dimensions.y = box_dimensions.y / ncelly;
+        
+        cellHead.assign(ncellx * ncelly, -1);
+        cellNext.resize(N);
+        
+        // Push each particle onto the front of the list for its cell
+        for (int i = 0; i < N; ++i) {
+            int c = cellIndex(cellX(positions.x[i]), cellY(positions.y[i]));
+            cellNext[i] = cellHead[c];
+            cellHead[c] = i;
+        }
+    }
+    
+    // Index into cellHead of the cell at column cx, row cy
+    int MDContainer::cellIndex(int cx, int cy) const { return cy * ncellx + cx; }
+    
+    // Column and row of the cell containing a position, clamped to the grid
+    int MDContainer::cellX(double x) const {
+        int cx = (int)(x / cell_dimensions.x);
+        return cx < 0 ? 0 : (cx >= ncellx ? ncellx - 1 : cx);
+    }
+    
+    int MDContainer::cellY(double y) const {
+        int cy = (int)(y / cell_dimensions.y);
+        return cy < 0 ? 0 : (cy >= ncelly ? ncelly - 1 : cy);
+    }
+    
+    /*
+        ROUTINE listNeedsRebuild:
+            Returns true if the neighbour list is out of date. As the list contains every pair within
+            rcutoff + skin, it stays correct until some particle has moved more than skin / 2 since it
+            was built, as then two particles could have closed the gap between them.
+            Also returns true if the list is a half list and a full one is wanted, or vice versa.
+     */
+    bool MDContainer::listNeedsRebuild(bool full) const
+    {
+        if (!listValid || full != fullList) { return true; }
+        return movedTooFar(listPositions);
+    }
+    
+    // true if any particle has moved more than skin / 2 from its position in saved
+    bool MDContainer::movedTooFar(const ParticleArray &saved) const
+    {
+        double limit2 = 0.25 * skin * skin; // (skin / 2)^2
+        double dx, dy;
+        for (int i = 0; i < N; ++i) {
+            dx = positions.x[i] - saved.x[i];
+            dy = positions.y[i] - saved.y[i];
+            if (dx * dx + dy * dy > limit2) { return true; }
+        }
+        return false;
+    }
+    
+    /*
+        ROUTINE buildFastList:
+            Builds the short neighbour list used for the fast pair forces in RESPA, of the pairs in the
+            main neighbour list within respaSplit + skin, in the same layout as the main list. It stays
+            correct until a particle has moved more than skin / 2, like the main list, and is rebuilt
+            whenever the main list is. The inner RESPA steps then only look at the close neighbours.
+     */
+    void MDContainer::buildFastList()
+    {
+        double rfast = respaSplit + skin;
+        double rfast2 = rfast * rfast;
+        
+        fastStart.resize(N + 1);
+        fastList.clear();
+        for (int i = 0; i < N; ++i) {
+            fastStart[i] = fastList.size();
+            for (int n = neighbourStart[i]; n < neighbourStart[i+1]; ++n) {
+                int j = neighbourList[n];
+                double dx = positions.x[j] - positions.x[i];
+                double dy = positions.y[j] - positions.y[i];
+                if (dx * dx + dy * dy < rfast2) { fastList.push_back(j); }
+            }
+        }
+        fastStart[N] = fastList.size();
+        
+        fastListPositions = positions;
+        fastListValid = true;
+    }
+    
+    /*
+        ROUTINE buildNeighbourList:
+            Rebuilds the Verlet neighbour list using the linked-cell index. If full is false, each pair
+            (i, j) within rcutoff + skin is stored once, in the list for i with j > i; otherwise it is
+            stored in the lists of both i and j. Saves the current positions so that listNeedsRebuild
+            can measure how far the particles have moved since.
+     */
+    void MDContainer::buildNeighbourList(bool full)
+    {
+        double rlist = rcutoff + skin;
+        double rlist2 = rlist * rlist;
+        buildCells(rlist);
+        
+        neighbourStart.resize(N + 1);
+        neighbourList.clear();
+        
+        coord ipos;
+        double dx, dy;
+        int cx, cy;
+        for (int i = 0; i < N; ++i) {
+            neighbourStart[i] = neighbourList.size();
+            ipos = positions.get(i);
+            cx = cellX(ipos.x);
+            cy = cellY(ipos.y);
+            
+            // Loop over the (up to) nine cells surrounding particle i
+            for (int ny = std::max(cy - 1, 0); ny <= std::min(cy + 1, ncelly - 1); ++ny) {
+                for (int nx = std::max(cx - 1, 0); nx <= std::min(cx + 1, ncellx - 1); ++nx) {
+                    for (int j = cellHead[cellIndex(nx, ny)]; j != -1; j = cellNext[j]) {
+                        if (j == i || (j < i && !full)) { continue; } // Only store each pair once in a half list
+                        
+                        dx = positions.x[j] - ipos.x;
+                        dy = positions.y[j] - ipos.y;
+                        if (dx * dx + dy * dy < rlist2) { neighbourList.push_back(j); }
+                    }
+                }
             }
         }
+        neighbourStart[N] = neighbourList.size();
+        
+        listPositions = positions;
+        listValid = true;
+        fullList = full;
+        fastListValid = false;
+        ++nRebuilds;
     }
     
     /* 
         ROUTINE forcesEnergies:
             Load-balance the force calculations for the system onto nthreads threads
-            using the standard threads library.
+            using the container's thread pool.
      
             Results in the forces and potential energy being stored in the forces matrix
-            and epot. Also calls externalForces.
+            and epot. Also calls externalForce for each thread's particles.
      */
     void MDContainer::forcesEnergies(int nthreads)
     {
-        // Initialise forces and energies to zero
-        epot = 0.0;
+        // Initialise forces to zero
         for (int i = 0; i < N; i++){
-            forces[i].x = 0.0;
-            forces[i].y = 0.0;
+            forces.x[i] = 0.0;
+            forces.y[i] = 0.0;
         }
+        
+        computeForces(nthreads);
+    }
+    
+    /*
+        ROUTINE computeForces:
+            As forcesEnergies, but adding the forces into the forces matrix, which must already
+            have been zeroed, as it is by drift.
+     
+            For RESPA, range picks the fast part of the pair forces, which go into forces, or the
+            slow part and the Gaussian forces, which go into slowForces; epot is then just the
+            energy of that part.
+     */
+    void MDContainer::computeForces(int nthreads, PairRange range)
+    {
+        epot = 0.0;
+        ParticleArray &target = range == SLOW_PAIRS ? slowForces : forces;
+        bool external = range != FAST_PAIRS;
+        
+        // Make sure the pool has the right number of threads
+        if (nthreads < 1) { nthreads = 1; }
+        pool.setNThreads(nthreads);
+        
+        // Bring the neighbour list up to date if the particles have moved too far. On one thread,
+        // a half list lets each pair be calculated once; on more, a full list lets each thread
+        // write only to the forces on its own particles, so no locks or force copies are needed.
+        // The fast RESPA forces use their own short list of close pairs, which only needs the
+        // main list to be checked when it is itself out of date
+        bool full = nthreads > 1;
+        if (range != FAST_PAIRS) {
+            if (listNeedsRebuild(full)) { buildNeighbourList(full); }
+            ++nListSteps;
+        } else if (!fastListValid || full != fullList || movedTooFar(fastListPositions)) {
+            if (listNeedsRebuild(full)) { buildNeighbourList(full); }
+            buildFastList();
+        }
+        const std::vector<int> &listStart = range == FAST_PAIRS ? fastStart : neighbourStart;
+        
+        // Resample the potential table if the potential has changed since it was last used
+        if (potential->isTabulated()) { potential->updateTable(); }
 
-        // Divide the N x N force matrices into roughly equal
-        // columnwise chunks of N/nthreads.
-        int spacing = ceil(N/nthreads);
-
-        // Make temporary arrays to store the values calculated on each thread
-        int start = 0, end = spacing, counter = 0; // Counters
-
-        std::vector<std::thread> thrds(nthreads); // Vector of threads
         std::vector<double> etemps(nthreads); // Vector of potential energies
+        threadTimes.resize(nthreads);
 
-        // Vector of temporary force matrices
-        std::vector <std::vector <coord>>  ftemps;
-        for (int i = 0; i < nthreads; i++){
-            // For large simulations, this would be very memory intensive,
-            // but for small simulations is more efficient than trying to deal
-            // with potential threading gridlocks.
-
-            ftemps.push_back(forces); // Makes sure they are the right shape
+        // Divide the particles into chunks with roughly equal numbers of pairs in their
+        // neighbour lists, rather than equal numbers of particles, as the lists can vary a
+        // lot in length. neighbourStart is a running total of the list lengths, so the start
+        // of chunk t is the first particle with t/nthreads of the pairs before it.
+        std::vector<int> chunks(nthreads + 1);
+        long npairs = listStart[N];
+        for (int t = 0; t < nthreads; ++t) {
+            int pairTarget = npairs * t / nthreads;
+            chunks[t] = std::lower_bound(listStart.begin(), listStart.begin() + N, pairTarget) - listStart.begin();
         }
+        chunks[nthreads] = N;
 
-        // Farm each portion of the forces matrix out to a thread
-        while (counter < nthreads){
-
-            // Create thread of forcesThread procedure
-            thrds[counter] = std::thread(&MDContainer::forcesThread, *this,
-                    start, end, std::ref(ftemps[counter]),
-                    std::ref(etemps[counter]), positions);
-
-            // Move to the next chunk of the forces matrix
-            start = end;
-            end += spacing;
-
-            // If nthreads does not divide N exactly, the last thread will have
-            // a different number of particles assigned, the last of which has
-            // index N-1
-            if (end > N-1) { end = N-1; }
-
-            // Increment thread counter
-            counter++;
-        }
+        // Farm each chunk out to a thread in the pool, timing each thread
+        // Each thread does the pair forces and then the Gaussian forces on its own particles
+        pool.run([&] (int t) {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            (this->*pairForces[range])(chunks[t], chunks[t+1], target, etemps[t]);
+            if (external) { externalForce(chunks[t], chunks[t+1], target, etemps[t]); }
+            threadTimes[t] = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        });
 
-        // Collect the results from each thread into the forces matrix, and epot variable
+        // Collect the potential energy from each thread
         for (int i = 0; i < nthreads; i++){
-            thrds[i].join(); // Waits for thread i to finish before proceeding
             epot += etemps[i];
-            for (int j = 0; j < N; j++){
-                forces[j].x += ftemps[i][j].x;
-                forces[j].y += ftemps[i][j].y;
-            }
         }
-
-        // Calculate the forces due to the external Gaussian potentials
-        externalForce();
     }
     
     /*
         ROUTINE forcesThread:
-            Calculates the Lennard-Jones forces and potential energy due to particles start through end interacting
-            with every other particle (in the upper triangular part of the forces matrix).
+            Calculates the pair forces and potential energy due to particles start through end interacting
+            with every other particle in their neighbour lists, as everything else is beyond rcutoff.
+            The neighbour list must be up to date.
      
-            Stores the results in ftemp and eptemp, respectively.
-            
-            npart is the number of particles, and postemp is a temporary array of the positions of the
-            particles.
+            The neighbours of each particle are taken in blocks of PotentialFunctor::BLOCK: the separations
+            of a block are gathered into small arrays, the energies and forces of the whole block are found
+            with one call to Functor::evaluateBlock, and the forces are then scattered back. Functor is the
+            concrete type of the potential, so the call is resolved at compile time, and simple potentials
+            like Lennard-Jones can be inlined and vectorised over the block.
+     
+            Range picks which part of the pair forces to calculate: all of them, or for RESPA, the fast part
+            S(r) F(r) or the slow part (1 - S(r)) F(r), where S is the switch returned by respaSwitch. For the
+            split ranges, only the pairs with a non-zero share are gathered into each block.
+     
+            Adds the forces into target, and stores the potential energy in eptemp. With a
+            half list, the reaction force on j is added as well, so only one thread may run at once.
+            With a full list, only the forces on particles start through end are written, so threads
+            with different ranges may run at once, and each pair energy is counted twice and halved.
      */
-    void MDContainer::forcesThread(int start, int end,
-            std::vector<coord> &ftemp, double &eptemp,
-            std::vector<coord> postemp)
-    {        
-        // Calculate the correction due to the shift of the Lennard-Jones potential
+    template <class Functor, int Range>
+    void MDContainer::forcesThread(int start, int end, ParticleArray &target, double &eptemp)
+    {
+        const int BLOCK = PotentialFunctor::BLOCK;
         double rcut2 = rcutoff*rcutoff;
-        double shift = -4.0*(pow(rcut2, -6) - pow(rcut2, -3));
+        Functor& pot = static_cast<Functor&>(*potential);
+        
+        // Pairs outside [rmin, rmax) have no share in this range
+        double rmin2 = 0.0, rmax2 = rcut2;
+        if (Range == FAST_PAIRS) { rmax2 = std::min(rcut2, respaSplit * respaSplit); }
+        if (Range == SLOW_PAIRS) { rmin2 = (respaSplit - RESPA_SWITCH_WIDTH) * (respaSplit - RESPA_SWITCH_WIDTH); }
 
         // Set potential energy to zero
         eptemp = 0.0;
 
-        // Placeholders for the separation (rij) and forces (fij) between particles i and j
-        // and the position of particle i (ipos)
-        coord rij, fij, ipos;
+        // Unpack the particle arrays so that the loops work on raw aligned arrays
+        // The fast forces only need the short list of close pairs
+        const double *px = positions.x.data(), *py = positions.y.data();
+        double *fx = target.x.data(), *fy = target.y.data();
+        const int *starts = Range == FAST_PAIRS ? fastStart.data() : neighbourStart.data();
+        const int *neighbours = Range == FAST_PAIRS ? fastList.data() : neighbourList.data();
+
+        // Neighbours, separations, squared distances, energies and force(r) / r for one block
+        int jb[BLOCK];
+        alignas(64) double dx[BLOCK], dy[BLOCK], d2[BLOCK], e[BLOCK], f[BLOCK];
 
-        double d2, r;  // d2 = |rij|^2, r = |rij|
-        double f; // force(rij) / rij
+        double ix, iy, fix, fiy; // position of and total force on particle i
+        double fijx, fijy;       // force between particles i and j
 
         // Loop over all particles from start to end
         for (int i = start; i < end; ++i) {
             // Unpack position of particle i
-            ipos.x = postemp[i].x;
-            ipos.y = postemp[i].y;
+            ix = px[i];
+            iy = py[i];
+            fix = fx[i];
+            fiy = fy[i];
 
-            for(int j = i+1; j < N; ++j){
-                // Compute rij
-                rij.x = postemp[j].x - ipos.x;
-                rij.y = postemp[j].y - ipos.y;
+            // Loop over the neighbours of particle i a block at a time
+            int n = starts[i], nend = starts[i+1];
+            while (n < nend) {
+                // Gather the separations rij
+                int m = 0;
+                if (Range == ALL_PAIRS) {
+                    for (; m < BLOCK && n < nend; ++m, ++n) {
+                        jb[m] = neighbours[n];
+                        dx[m] = px[jb[m]] - ix;
+                        dy[m] = py[jb[m]] - iy;
+                        d2[m] = dx[m] * dx[m] + dy[m] * dy[m];
+                    }
+                } else {
+                    // only keep the pairs in this part of the split
+                    for (; m < BLOCK && n < nend; ++n) {
+                        int j = neighbours[n];
+                        double x = px[j] - ix, y = py[j] - iy, r2 = x * x + y * y;
+                        if (r2 >= rmin2 && r2 < rmax2) {
+                            jb[m] = j;
+                            dx[m] = x;
+                            dy[m] = y;
+                            d2[m] = r2;
+                            ++m;
+                        }
+                    }
+                }
                 
-                d2 = rij.x * rij.x + rij.y * rij.y;
-                if (d2 < rcut2) { // Check if within cutoff radius
-                    r = sqrt(d2);
-                    
-                    // Energy and forces
-                    eptemp += potential->potential(r);
-                    f = potential->force(r) / r;
+                // Energies and forces, which are zero beyond the cutoff radius
+                pot.evaluateBlock(d2, e, f, m, rmax2);
+                
+                // Share out the forces between the fast and slow parts
+                if (Range != ALL_PAIRS) {
+                    for (int k = 0; k < m; ++k) {
+                        double w = respaSwitch(sqrt(d2[k]));
+                        if (Range == SLOW_PAIRS) { w = 1.0 - w; }
+                        e[k] *= w;
+                        f[k] *= w;
+                    }
+                }
+                
+                // Scatter the forces
+                for (int k = 0; k < m; ++k) {
+                    eptemp += e[k];
                     
-                    fij.x = f * rij.x;
-                    fij.y = f * rij.y;
+                    fijx = f[k] * dx[k];
+                    fijy = f[k] * dy[k];
                     
-                    ftemp[i].x += fij.x;
-                    ftemp[i].y += fij.y;
+                    fix += fijx;
+                    fiy += fijy;
                     
-                    ftemp[j].x -= fij.x;
-                    ftemp[j].y -= fij.y;
-                } // End if
-            } // End inner for-loop
+                    if (!fullList) {
+                        fx[jb[k]] -= fijx;
+                        fy[jb[k]] -= fijy;
+                    }
+                }
+            } // End inner loop
+            
+            fx[i] = fix;
+            fy[i] = fiy;
         } // End outer for-loop
+        
+        // Each pair has been counted from both ends in a full list
+        if (fullList) { eptemp *= 0.5; }
+    }
+    
+    /*
+        ROUTINE respaSwitch:
+            The share of a pair force at separation r which goes into the fast part for RESPA:
+            1 below respaSplit - RESPA_SWITCH_WIDTH, 0 above respaSplit, and a smooth cubic between.
+     */
+    double MDContainer::respaSwitch(double r) const
+    {
+        double x = (r - (respaSplit - RESPA_SWITCH_WIDTH)) / RESPA_SWITCH_WIDTH;
+        if (x <= 0.0) { return 1.0; }
+        if (x >= 1.0) { return 0.0; }
+        return 1.0 - x * x * (3.0 - 2.0 * x);
+    }
+    
+    /*
+        ROUTINE drift:
+            First half of the velocity-Verlet step for particles start through end. Applies any
+            pending Berendsen rescaling, scale, to the velocities, updates the positions and
+            half-updates the velocities using the forces, then reflects any particle which has
+            crossed a hard wall. The forces are zeroed once they have been read, ready for the
+            next force calculation, so that this needs no separate pass. Written with selects
+            rather than branches so that the loop can be vectorised.
+     */
+    void MDContainer::drift(int start, int end, double scale)
+    {
+        double dt2 = 0.5 * dt * dt; // Useful quantity for velocity verlet, dt^2/2
+        double hdt = 0.5 * dt;
+        double width = box_dimensions.x, height = box_dimensions.y;
+        
+        double *x = positions.x.data(), *y = positions.y.data();
+        double *vx = velocities.x.data(), *vy = velocities.y.data();
+        double *fx = forces.x.data(), *fy = forces.y.data();
+        
+        for (int i = start; i < end; ++i) {
+            double vxi = scale * vx[i], vyi = scale * vy[i];
+            
+            double xnew = x[i] + (dt * vxi + dt2 * fx[i]); // Update position
+            double ynew = y[i] + (dt * vyi + dt2 * fy[i]);
+            double vxnew = vxi + hdt * fx[i];              // Half-update velocity
+            double vynew = vyi + hdt * fy[i];
+            fx[i] = 0.0;
+            fy[i] = 0.0;
+            
+            // Hard-wall boundary conditions - reflect if collided with box wall
+            bool overx = xnew > width, underx = xnew < 0;
+            bool overy = ynew > height, undery = ynew < 0;
+            x[i] = overx ? 2 * width - xnew : (underx ? -xnew : xnew);
+            y[i] = overy ? 2 * height - ynew : (undery ? -ynew : ynew);
+            vx[i] = (overx || underx) ? -vxnew : vxnew;
+            vy[i] = (overy || undery) ? -vynew : vynew;
+        }
+    }
+    
+    /*
+        ROUTINE kick:
+            Second half-update of the velocities of particles start through end, using the new
+            forces f over a time hdt (half a time step). Returns in sums the sum of the squared
+            speeds, for the kinetic energy, the sum of |vx| + |vy|, for the Berendsen thermostat,
+            and the largest squared force and speed, for the adaptive time step, so that none of
+            these needs another pass over the particles.
+     
+            If speedHist is given, the new speeds are also added to it, with the bins of
+            speedHistory between 0 and speedHistMax. The particles are gone through in blocks, and
+            the squared speeds of each block kept to be binned while they are still in cache.
+     */
+    void MDContainer::kick(int start, int end, const ParticleArray &f, double hdt, KickSums &sums, double *speedHist)
+    {
+        double *vx = velocities.x.data(), *vy = velocities.y.data();
+        const double *fx = f.x.data(), *fy = f.y.data();
+        
+        const int BLOCK = 256;
+        double speeds[BLOCK];
+        
+        double v2 = 0.0, vabs = 0.0, fmax2 = 0.0, vmax2 = 0.0;
+        for (int block = start; block < end; block += BLOCK) {
+            int blockEnd = std::min(block + BLOCK, end);
+            
+            for (int i = block; i < blockEnd; ++i) {
+                vx[i] += hdt * fx[i];
+                vy[i] += hdt * fy[i];
+                
+                double vi2 = vx[i] * vx[i] + vy[i] * vy[i];
+                double fi2 = fx[i] * fx[i] + fy[i] * fy[i];
+                v2 += vi2;
+                vabs += fabs(vx[i]) + fabs(vy[i]);
+                vmax2 = vi2 > vmax2 ? vi2 : vmax2;
+                fmax2 = fi2 > fmax2 ? fi2 : fmax2;
+                speeds[i - block] = vi2;
+            }
+            
+            if (speedHist) {
+                int n = blockEnd - block;
+                for (int k = 0; k < n; ++k) { speeds[k] = sqrt(speeds[k]); }
+                util::histogramAdd(speeds, n, 0.0, speedHistMax, speedHist, speedHistory.getBins());
+            }
+        }
+        
+        sums.v2 = v2;
+        sums.vabs = vabs;
+        sums.fmax2 = fmax2;
+        sums.vmax2 = vmax2;
+    }
+    
+    /*
+        ROUTINE kickAll:
+            Kicks all the particles, split over nthreads threads of the pool, and combines the
+            sums from each thread. If binSpeeds is true, the new speeds are binned into speedCounts
+            as well, each thread binning its own particles, ready to be saved in speedHistory.
+     */
+    KickSums MDContainer::kickAll(int nthreads, const ParticleArray &f, double hdt, bool binSpeeds)
+    {
+        std::vector<KickSums> sums(nthreads);
+        int bins = speedHistory.getBins();
+        if (binSpeeds && threadSpeedCounts.size() < (std::size_t)nthreads) { threadSpeedCounts.resize(nthreads); }
+        
+        pool.run([&] (int t) {
+            double *speedHist = nullptr;
+            if (binSpeeds) {
+                threadSpeedCounts[t].assign(bins, 0.0);
+                speedHist = threadSpeedCounts[t].data();
+            }
+            kick(N * t / nthreads, N * (t + 1) / nthreads, f, hdt, sums[t], speedHist);
+        });
+        
+        if (binSpeeds) {
+            speedCounts = threadSpeedCounts[0];
+            for (int t = 1; t < nthreads; ++t) {
+                for (int b = 0; b < bins; ++b) { speedCounts[b] += threadSpeedCounts[t][b]; }
+            }
+            speedCountsFresh = true;
+        }
+        
+        KickSums total = {0.0, 0.0, 0.0, 0.0};
+        for (int t = 0; t < nthreads; ++t) {
+            total.v2 += sums[t].v2;
+            total.vabs += sums[t].vabs;
+            total.fmax2 = std::max(total.fmax2, sums[t].fmax2);
+            total.vmax2 = std::max(total.vmax2, sums[t].vmax2);
+        }
+        return total;
+    }
+    
+    /*
+        ROUTINE flushVelocityScale:
+            Applies any Berendsen rescaling which has not yet been folded into a drift, so that the
+            stored velocities are up to date.
+     */
+    void MDContainer::flushVelocityScale()
+    {
+        if (velocityScale == 1.0) { return; }
+        
+        for (int i = 0; i < N; ++i) {
+            velocities.x[i] *= velocityScale;
+            velocities.y[i] *= velocityScale;
+        }
+        velocityScale = 1.0;
     }
     
     /*
@@ -482,219 +1191,482 @@ namespace md {
             MDContainer is set up, and a single forcesEnergies calculation performed, this routine
             is all that needs to be called to propagate the system by one timestep. 
      
+            The step makes two sweeps over the particles, the drift and the kick, either side of
+            the force calculation, with any pending thermostat rescaling folded into the drift.
+            Both sweeps are split over the thread pool in equal chunks of particles.
+     
             nthreads is the number of threads the forces calculations should be performed on
      */
     void MDContainer::integrate(int nthreads)
     {
-        double dt2 = 0.5 * dt * dt; // Useful quantity for velocity verlet, dt^2/2
-
-        for (int i = 0; i < N; ++i){ // Loop over particles
-
-            // Update positions
-            positions[i].x += dt * velocities[i].x + dt2 * forces[i].x;
-            positions[i].y += dt * velocities[i].y + dt2 * forces[i].y;
-            
-            // Half-update velocities
-            velocities[i].x += 0.5 * dt * forces[i].x;
-            velocities[i].y += 0.5 * dt * forces[i].y;
-
-            // Hard-wall boundary conditions - reflect if collided with box wall
-            if (positions[i].x > box_dimensions.x) {
-                positions[i].x = 2 * box_dimensions.x - positions[i].x;
-                velocities[i].x *= -1;
-            } else if (positions[i].x < 0) {
-                positions[i].x *= -1;
-                velocities[i].x *= -1;
-            }
-            
-            if (positions[i].y > box_dimensions.y) {
-                positions[i].y = 2 * box_dimensions.y - positions[i].y;
-                velocities[i].y *= -1;
-            } else if (positions[i].y < 0) {
-                positions[i].y *= -1;
-                velocities[i].y *= -1;
-            }
-
+        if (integrator == RESPA) {
+            integrateRespa(nthreads);
+            return;
         }
+        
+        if (nthreads < 1) { nthreads = 1; }
+        pool.setNThreads(nthreads);
+        
+        // Pick the time step from the last forces and speeds
+        adaptTimestep();
+        
+        // Update positions and half-update velocities, zeroing the forces
+        double scale = velocityScale;
+        pool.run([&] (int t) {
+            drift(N * t / nthreads, N * (t + 1) / nthreads, scale);
+        });
+        velocityScale = 1.0;
 
         // Compute forces and energies on nthreads threads
-        forcesEnergies(nthreads);
+        computeForces(nthreads);
 
-        ekin = 0.0;
-        for (int i = 0; i < N; i++){
-            // Second half-update to velocities
-            velocities[i].x += 0.5 * dt * forces[i].x;
-            velocities[i].y += 0.5 * dt * forces[i].y;
-            
-            // Calculate kinetic energy of i
-            ekin += velocities[i].x * velocities[i].x;
-            ekin += velocities[i].y * velocities[i].y;
+        // Second half-update to velocities, and calculate the kinetic energy and speed histogram
+        KickSums sums = kickAll(nthreads, forces, 0.5 * dt, true);
+        ekin = 0.5 * sums.v2;
+        sumAbsVel = sums.vabs;
+        maxForce2 = sums.fmax2;
+        maxSpeed2 = sums.vmax2;
+        countStep();
+    }
+    
+    /*
+        ROUTINE integrateRespa:
+            One outer step of the r-RESPA multiple time step integrator, which advances the system
+            by respaSteps * dt. The pair forces are split with respaSwitch into a fast part, from
+            close pairs including the repulsive wall, and a slow part, from the rest of the pairs
+            and the Gaussians. The slow forces give a half-kick at each end of the outer step,
+            and in between, respaSteps ordinary velocity-Verlet steps of dt are taken with just
+            the fast forces, which only need the few neighbours within respaSplit. The expensive
+            full pair search is then only done once per outer step, while the wall is still
+            integrated with the small time step dt.
+     
+            The fast forces are kept in forces, and the slow in slowForces, which are recalculated
+            first if they are out of date.
+     */
+    void MDContainer::integrateRespa(int nthreads)
+    {
+        if (nthreads < 1) { nthreads = 1; }
+        pool.setNThreads(nthreads);
+        
+        // Pick the inner time step from the last forces and speeds
+        adaptTimestep();
+        
+        double hDt = 0.5 * respaSteps * dt; // half the outer time step
+        
+        // Make sure both parts of the forces are up to date
+        if (!slowForcesValid || slowForces.size() != N) {
+            slowForces.resize(N);
+            for (int i = 0; i < N; ++i) {
+                forces.x[i] = forces.y[i] = 0.0;
+                slowForces.x[i] = slowForces.y[i] = 0.0;
+            }
+            computeForces(nthreads, FAST_PAIRS);
+            computeForces(nthreads, SLOW_PAIRS);
+            slowForcesValid = true;
+        }
+        
+        // Half-kick with the slow forces, applying any pending thermostat rescaling, and zeroing
+        // the slow forces ready for the end of the step
+        double scale = velocityScale;
+        velocityScale = 1.0;
+        pool.run([&] (int t) {
+            double *vx = velocities.x.data(), *vy = velocities.y.data();
+            double *fx = slowForces.x.data(), *fy = slowForces.y.data();
+            for (int i = N * t / nthreads; i < N * (t + 1) / nthreads; ++i) {
+                vx[i] = scale * vx[i] + hDt * fx[i];
+                vy[i] = scale * vy[i] + hDt * fy[i];
+                fx[i] = fy[i] = 0.0;
+            }
+        });
+        
+        // Inner velocity-Verlet steps with the fast forces
+        KickSums fastSums;
+        for (int s = 0; s < respaSteps; ++s) {
+            pool.run([&] (int t) {
+                drift(N * t / nthreads, N * (t + 1) / nthreads, 1.0);
+            });
+            computeForces(nthreads, FAST_PAIRS);
+            fastSums = kickAll(nthreads, forces, 0.5 * dt);
         }
-        ekin *= 0.5;
+        double efast = epot;
+        
+        // Slow forces at the new positions, and the closing half-kick
+        computeForces(nthreads, SLOW_PAIRS);
+        epot += efast;
+        KickSums sums = kickAll(nthreads, slowForces, hDt, true);
+        
+        ekin = 0.5 * sums.v2;
+        sumAbsVel = sums.vabs;
+        maxForce2 = std::max(fastSums.fmax2, sums.fmax2);
+        maxSpeed2 = sums.vmax2;
+        countStep();
+    }
+    
+    /*
+        ROUTINE setIntegrator:
+            Switches between velocity Verlet and RESPA, with nsteps inner steps of dt per outer
+            step and the pair forces split at a distance split for RESPA. The forces are
+            recalculated in the form the new integrator needs.
+     */
+    void MDContainer::setIntegrator(Integrator _integrator, int nsteps, double split)
+    {
+        integrator = _integrator;
+        respaSteps = nsteps > 0 ? nsteps : 4;
+        respaSplit = split > RESPA_SWITCH_WIDTH ? split : 2.0;
+        slowForcesValid = false;
+        fastListValid = false;
+        
+        // velocity Verlet needs the full forces, but RESPA recalculates its own
+        if (integrator == VELOCITY_VERLET && N > 0) { forcesEnergies(pool.getNThreads()); }
+    }
+    
+    Integrator MDContainer::getIntegrator() const { return integrator; }
+    int MDContainer::getRespaSteps() const { return respaSteps; }
+    double MDContainer::getStepTime() const { return integrator == RESPA ? respaSteps * dt : dt; }
+    double MDContainer::getRespaSplit() const { return respaSplit; }
+    
+    /*
+        ROUTINE adaptTimestep:
+            In adaptive mode, picks the time step for the next step from the largest force and speed
+            found in the last kick, as the largest dt for which no particle would move more than
+            maxStep: dt * vmax + dt^2 * fmax / 2 <= maxStep, which is ensured by taking the smaller of
+            maxStep / vmax and sqrt(2 * maxStep / fmax). dt may only grow or shrink by the factors
+            dtGrowth and dtShrink in one step, and always stays between dtMin and dtMax.
+     */
+    void MDContainer::adaptTimestep()
+    {
+        if (!adaptiveDt || maxForce2 < 0) { return; } // no forces calculated yet
+        
+        double target = dtMax;
+        if (maxSpeed2 > 0) { target = std::min(target, maxStep / sqrt(maxSpeed2)); }
+        if (maxForce2 > 0) { target = std::min(target, sqrt(2 * maxStep / sqrt(maxForce2))); }
+        
+        target = util::clamp(target, dt * dtShrink, dt * dtGrowth);
+        dt = util::clamp(target, dtMin, dtMax);
+    }
+    
+    /*
+        ROUTINE setAdaptiveTimestep:
+            Switches the adaptive time step on or off. When on, dt stays between _dtMin and _dtMax, with
+            no particle moving more than _maxStep in one step, and changes by at most a factor of growth
+            or shrink per step. When switched off, dt goes back to the value last set by setTimestep.
+            Values which are out of range or not finite are replaced by the defaults.
+     */
+    void MDContainer::setAdaptiveTimestep(bool on, double _dtMin, double _dtMax, double _maxStep, double growth, double shrink)
+    {
+        adaptiveDt = on;
+        dtMin = (_dtMin > 0 && std::isfinite(_dtMin)) ? _dtMin : 0.0005;
+        dtMax = (_dtMax >= dtMin && std::isfinite(_dtMax)) ? _dtMax : std::max(dtMin, 0.008);
+        maxStep = (_maxStep > 0 && std::isfinite(_maxStep)) ? _maxStep : 0.015;
+        dtGrowth = (growth >= 1 && std::isfinite(growth)) ? growth : 1.05;
+        dtShrink = (shrink > 0 && shrink <= 1) ? shrink : 0.5;
+        
+        if (!adaptiveDt) { dt = fixedDt; }
+    }
+    
+    bool MDContainer::getAdaptiveTimestep() const { return adaptiveDt; }
+    
+    StepStats MDContainer::getStepStats() const { return stepStats; }
+    
+    void MDContainer::resetStepStats() {
+        stepStats.steps = 0;
+        stepStats.time = stepStats.dtSum = 0.0;
+        stepStats.dtMin = stepStats.dtMax = 0.0;
+    }
+    
+    void MDContainer::countStep() {
+        if (stepStats.steps == 0) { stepStats.dtMin = stepStats.dtMax = dt; }
+        ++stepStats.steps;
+        stepStats.time += getStepTime();
+        stepStats.dtSum += dt;
+        stepStats.dtMin = std::min(stepStats.dtMin, dt);
+        stepStats.dtMax = std::max(stepStats.dtMax, dt);
     }
     
     /*
         ROUTINE savePreviousValues:
-            Saves the current position in prevPos and the current energies
-            in prevEpot and prevEKin. A maximum of 15 positions and 120
-            energies are kept, using a deque for the FIFO behaviour and
-            storing the most recent position / energy at index 0
+            Saves the current position in prevPositions and the current energies
+            in prevEpot and prevEKin, and the time step in prevDt. A maximum of
+            getTrailLength() positions (20 by default) are kept in a ring buffer,
+            and getEnergyHistoryLength() energies (120 by default) in sliding
+            windows, which update their minima and maxima as each value is
+            pushed, with the most recent position / energy at index 0. The speed
+            histogram binned in the last step, if any, is added to speedHistory
      */
     void MDContainer::savePreviousValues()
     {
-        prevPositions.push_front(positions);
-        prevEPot.push_front(epot);
-        prevEKin.push_front(ekin);
+        prevPositions.push(positions);
+        prevEPot.push(epot);
+        prevEKin.push(ekin);
+        prevDt.push(dt);
         
-        if (prevPositions.size() == 20) prevPositions.pop_back();
-        if (prevEPot.size() == 120) prevEPot.pop_back();
-        if (prevEKin.size() == 120) prevEKin.pop_back();
-        
-        // Find the maximum/minimum elements in prevEKin and prevEPot
-        std::deque<double>::iterator EKMAX = std::max_element(prevEKin.begin(), prevEKin.end());
-        std::deque<double>::iterator EPMAX = std::max_element(prevEPot.begin(), prevEPot.end());
-        std::deque<double>::iterator EKMIN = std::min_element(prevEKin.begin(), prevEKin.end());
-        std::deque<double>::iterator EPMIN = std::min_element(prevEPot.begin(), prevEPot.end());
-        maxEKin = prevEKin[std::distance(prevEKin.begin(), EKMAX)];
-        maxEPot = prevEPot[std::distance(prevEPot.begin(), EPMAX)];
-        minEKin = prevEKin[std::distance(prevEKin.begin(), EKMIN)];
-        minEPot = prevEPot[std::distance(prevEPot.begin(), EPMIN)];
+        if (speedCountsFresh) {
+            speedHistory.push(speedCounts.data());
+            speedCountsFresh = false;
+        }
     }
     
     /*
         ROUTINE run:
             Runs the integrator nsteps times, with a thermostat frequency
             freq, on nthreads threads. Saves the positions and energies after
-            all nsteps integrations are completed
+            all nsteps integrations are completed, once the last thermostat
+            rescaling has been applied to the velocities. Each step is passed
+            to the trajectory writer, if there is one, before the thermostat,
+            while the velocities still match the kinetic energy
      */
     void MDContainer::run(int nthreads) {
         if (running) {
             for (int i = 0; i < stepsPerUpdate; ++i) {
                 integrate(nthreads);
-                berendsen(freq);
+                if (trajectory) { trajectory->step(*this); }
+                berendsen(freq, getStepTime());
             }
+            flushVelocityScale();
             savePreviousValues();
         }
     }
 
 
+    //----------------------RADIAL DISTRIBUTION--------------------
+    
+    RadialDistribution::RadialDistribution(double _min, double _max, int _bins) { setRange(_min, _max, _bins); }
+    
+    void RadialDistribution::setRange(double _min, double _max, int _bins) {
+        min = _min;
+        max = _max > _min ? _max : _min + 1.0;
+        bins = _bins > 0 ? _bins : 1;
+        clear();
+    }
+    
+    void RadialDistribution::clear() {
+        counts.assign(bins, 0.0);
+        nframes = 0;
+    }
+    
+    int RadialDistribution::getNFrames() const { return nframes; }
+    const std::vector <double>& RadialDistribution::getCounts() const { return counts; }
+    
+    std::vector <double> RadialDistribution::getHistogram() const {
+        std::vector <double> hist = counts;
+        util::normaliseHistogram(hist);
+        return hist;
+    }
+    
     /*
-        ROUTINE rdf:
-            Calculates a histogram of particle separations, binning based on a given number of
-            bins, and a minimum and maximum separation to include.
+        ROUTINE accumulate:
+            Sorts the particles into cells at least max wide over the area they cover, with at
+            most about two cells per particle, so that a short max does not make a huge grid.
+            Each cell is then paired with itself and with the four neighbours to its east and
+            north (the half-shell), so that every pair of neighbouring cells is visited once.
+            Separations in [min, max] are binned directly; the bin is (d - min) / binwidth.
      */
-    std::vector <double> MDContainer::rdf(double min, double max, int bins) const {
-        std::vector <double> dists;
-        int N = getN();
-        int N_dists = (N * (N-1)) / 2;
-        dists.reserve(N_dists);
-        coord posi, posj;
-        double dx, dy;
+    void RadialDistribution::accumulate(const ParticleArray &positions, int N, ThreadPool *pool) {
+        ++nframes;
+        if (N < 2) { return; }
         
-        for (int i = 0; i < N; ++i) {
-            for (int j = i+1; j < N; ++j) {
-                posi = getPos(i);
-                posj = getPos(j);
-                dx = posi.x - posj.x;
-                dy = posi.y - posj.y;
-                dists.push_back(sqrt(dx * dx + dy * dy));
+        const double *px = positions.x.data(), *py = positions.y.data();
+        
+        // area covered by the particles
+        double xlo = px[0], xhi = px[0], ylo = py[0], yhi = py[0];
+        for (int i = 1; i < N; ++i) {
+            xlo = std::min(xlo, px[i]); xhi = std::max(xhi, px[i]);
+            ylo = std::min(ylo, py[i]); yhi = std::max(yhi, py[i]);
+        }
+        double width = xhi - xlo, height = yhi - ylo;
+        
+        double side = std::max(max, sqrt(width * height / (2.0 * N)));
+        int ncx = std::max(1, (int)(width / side));
+        int ncy = std::max(1, (int)(height / side));
+        double invx = ncx / std::max(width, 1e-300), invy = ncy / std::max(height, 1e-300);
+        
+        cellHead.assign(ncx * ncy, -1);
+        cellNext.resize(N);
+        for (int i = N - 1; i >= 0; --i) { // backwards, so that each cell's list is in order
+            int cx = std::min(ncx - 1, (int)((px[i] - xlo) * invx));
+            int cy = std::min(ncy - 1, (int)((py[i] - ylo) * invy));
+            int c = cy * ncx + cx;
+            cellNext[i] = cellHead[c];
+            cellHead[c] = i;
+        }
+        
+        int nthreads = pool ? pool->getNThreads() : 1;
+        threadCounts.resize(nthreads);
+        
+        const double min2 = min * min, max2 = max * max;
+        const double invBinWidth = bins / (max - min);
+        
+        // bin the pairs with a first particle in rows rowlo to rowhi - 1 of cells into hist
+        auto binRows = [&] (int rowlo, int rowhi, std::vector <double> &hist) {
+            hist.assign(bins, 0.0);
+            const int offsets[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+            
+            for (int cy = rowlo; cy < rowhi; ++cy) {
+                for (int cx = 0; cx < ncx; ++cx) {
+                    for (int i = cellHead[cy * ncx + cx]; i != -1; i = cellNext[i]) {
+                        double xi = px[i], yi = py[i];
+                        
+                        // the rest of the same cell, then the half-shell of neighbouring cells
+                        for (int n = -1; n < 4; ++n) {
+                            int j;
+                            if (n < 0) { j = cellNext[i]; }
+                            else {
+                                int nx = cx + offsets[n][0], ny = cy + offsets[n][1];
+                                if (nx < 0 || nx >= ncx || ny >= ncy) { continue; }
+                                j = cellHead[ny * ncx + nx];
+                            }
+                            
+                            for (; j != -1; j = cellNext[j]) {
+                                double dx = px[j] - xi, dy = py[j] - yi;
+                                double d2 = dx * dx + dy * dy;
+                                if (d2 < min2 || d2 > max2) { continue; }
+                                int b = (int)((sqrt(d2) - min) * invBinWidth);
+                                hist[b < bins ? b : bins - 1] += 1.0;
+                            }
+                        }
+                    }
+                }
             }
+        };
+        
+        if (pool) {
+            pool->run([&] (int t) { binRows(ncy * t / nthreads, ncy * (t + 1) / nthreads, threadCounts[t]); });
+        } else {
+            binRows(0, ncy, threadCounts[0]);
         }
-
+        
+        for (int t = 0; t < nthreads; ++t) {
+            for (int b = 0; b < bins; ++b) { counts[b] += threadCounts[t][b]; }
+        }
+    }
+    
+    /*
+        ROUTINE separationHistogram:
+            Calculates a histogram of particle separations, binning based on a given number of
+            bins, and a minimum and maximum separation to include, for a single frame.
+     */
+    std::vector <double> separationHistogram(const ParticleArray &positions, int N, double min, double max, int bins) {
+        RadialDistribution distribution(min, max, bins);
+        distribution.accumulate(positions, N);
+        
         // NOTE: this does not properly weight the RDF by the distance
         // but the RDF plot looks better this way anyway
-        return util::histogram(dists, min, max, bins);
+        return distribution.getHistogram();
     }
 
     
     /*
-        ROUTINE maxwell:
+        ROUTINE speedHistogram:
             Calculates a histogram of particle speeds, binning based on a given number of
-            bins, and a minimum and maximum speed to include.
+            bins, and a minimum and maximum speed to include. The speeds are worked out a block
+            at a time and binned straight away, so they are never all stored. Given a pool, each
+            thread bins a share of the particles into its own histogram.
      */
-    std::vector <double> MDContainer::maxwell(double min, double max, int bins) const {
-        std::vector <double> speeds;
-        int N = getN();
-        speeds.reserve(N);
+    std::vector <double> speedHistogram(const ParticleArray &velocities, int N, double min, double max, int bins, ThreadPool *pool) {
+        const double *vx = velocities.x.data(), *vy = velocities.y.data();
         
-        for (int i = 0; i < N; ++i) {
-            coord vel = getVel(i);
-            speeds.push_back(sqrt(vel.x * vel.x + vel.y * vel.y));
+        auto binRange = [&] (int start, int end, std::vector <double> &hist) {
+            const int BLOCK = 256;
+            double speeds[BLOCK];
+            hist.assign(bins, 0.0);
+            
+            for (int i = start; i < end; i += BLOCK) {
+                int m = std::min(BLOCK, end - i);
+                for (int k = 0; k < m; ++k) { speeds[k] = sqrt(vx[i + k] * vx[i + k] + vy[i + k] * vy[i + k]); }
+                util::histogramAdd(speeds, m, min, max, hist.data(), bins);
+            }
+        };
+        
+        int nthreads = pool ? pool->getNThreads() : 1;
+        std::vector <std::vector <double>> threadHists(nthreads);
+        if (pool) {
+            pool->run([&] (int t) { binRange(N * t / nthreads, N * (t + 1) / nthreads, threadHists[t]); });
+        } else {
+            binRange(0, N, threadHists[0]);
         }
-
-        return util::histogram(speeds, min, max, bins);
+        
+        std::vector <double> hist = threadHists[0];
+        for (int t = 1; t < nthreads; ++t) {
+            for (int b = 0; b < bins; ++b) { hist[b] += threadHists[t][b]; }
+        }
+        util::normaliseHistogram(hist);
+        return hist;
+    }
+    
+    // The radial and speed distributions of the system as it is now
+    std::vector <double> MDContainer::rdf(double min, double max, int bins) const {
+        return separationHistogram(positions, N, min, max, bins);
+    }
+    void MDContainer::accumulateRdf(RadialDistribution &distribution) {
+        distribution.accumulate(positions, N, &pool);
+    }
+    std::vector <double> MDContainer::maxwell(double min, double max, int bins) const {
+        return speedHistogram(velocities, N, min, max, bins);
     }
 
     
     
     //----------------------------------------THERMOSTATS----------------------------------------
     /*
-        ROUTINE random_vel:
-            Returns a random velocity from the Maxwell-Boltzmann distribution
+        ROUTINE randomVel:
+            Returns a random velocity from the Maxwell-Boltzmann distribution for particle i,
+            which is fixed by the seed, i and the draw number, so that particles may be given
+            velocities in any order and on any thread
      
         ANDERSEN:
             Random collisions with the heat bath, so that velocities are sampled from (roughly)
             a Maxwell distribution corresponding to the desired temperature, T.
      
             Depending on the value set for the frequency (freq) of collisions, this can be very slow to
-            update the temperature of the system.
+            update the temperature of the system. Each particle collides with probability freq * step,
+            where step is the time advanced since the last call.
         
         BERENDSEN:
             Rescales the velocities of all particles, with a damping strength controlled by the frequency (freq)
             so that they obey:
             
             3/2 NkT = 1/2 mv^2
+     
+            The coupling is scaled by step, the time advanced by the last integrate, which under
+            RESPA is the whole outer step.
+     
+            The average velocity comes from the sums made in the last kick, so this must follow integrate.
+            The rescaling itself is deferred, and applied by the next drift or at the end of run.
      */
     
-    coord MDContainer::randomVel() const
+    coord MDContainer::randomVel(int i, std::uint64_t draw) const
     {
-        // Set up random number generator, rd, to sample from:
-        // normal distribution, nDist, mean 0, std. dev. sqrt(T)
-        std::random_device rd;
-        std::mt19937 mt(rd());
-        std::normal_distribution<double> nDist(0.0, sqrt(T));
-        
-        coord vel;
-        vel.x = nDist(mt);
-        vel.y = nDist(mt);
-        return vel;
+        // normal distribution, mean 0, std. dev. sqrt(T), for particle i in this draw
+        return rng.normal2(draw, i, sqrt(T));
     }
     
-    void MDContainer::andersen(double freq)
+    void MDContainer::andersen(double freq, double step)
     {
-        // Set up random number generator, rd, to sample from:
-        // uniform distribution, uDist, on [0, 1]
-        std::random_device rd;
-        std::mt19937 mt(rd());
-        std::uniform_real_distribution<double> uDist(0.0, 1.0);
+        // Take a fresh pair of draws: one for the collision tests and one for the new velocities
+        std::uint64_t draw = nextDraw();
         
-        // Randomly select particles to collide with the heat bath
-        for (int i = 0; i < N; i++) {
-            if(uDist(mt) < freq*dt) velocities[i] = randomVel();
-        }
+        // Randomly select particles to collide with the heat bath, split over the thread pool
+        int nthreads = pool.getNThreads();
+        pool.run([&] (int t) {
+            for (int i = N * t / nthreads; i < N * (t + 1) / nthreads; i++) {
+                if (rng.uniform(draw + 1, i) < freq*step) velocities.set(i, randomVel(i, draw));
+            }
+        });
     }
 
-    void MDContainer::berendsen(double freq)
+    void MDContainer::berendsen(double freq, double step)
     {
-        //Calculate the average velocity
-        v_avg = 0;
-        for (int i = 0; i < N; i++){
-            v_avg += fabs(velocities[i].x);
-            v_avg += fabs(velocities[i].y);
-        }
-        v_avg /= N;
+        //Calculate the average velocity, from the sum made during the kick
+        v_avg = sumAbsVel / N;
         
         //Calculate scaling factor (lambda)
         if (v_avg > 1e-5) {
-            double lambda = sqrt(1+((dt*freq)*((T/v_avg)-1)));
-            for (int i = 0; i < N; i++){
-                //Scale the velocity of each particle
-                velocities[i].x *= lambda;
-                velocities[i].y *= lambda;
-            }
+            double lambda = sqrt(1+((step*freq)*((T/v_avg)-1)));
+            //Scale the velocity of each particle in the next drift
+            velocityScale *= lambda;
         } else {
             // if the particles aren't moving and we want them to, collide everything with an andersen heatbath
-            andersen(1000000);
+            andersen(1000000, step);
         }
     }
 }
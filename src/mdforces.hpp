@@ -26,13 +26,203 @@
 #define MDFORCES_HEADER_DEF
 
 #include <vector>
-#include <deque>
 #include "gaussian.hpp"
 #include "utilities.hpp"
 #include "potentials.hpp"
+#include "threadpool.hpp"
 
 namespace md{
+    
+    // An aligned array with one double per particle
+    typedef std::vector <double, util::AlignedAllocator <double>> AlignedArray;
+    
+    struct ParticleArray
+    {
+        /*
+            Stores a two-dimensional quantity for every particle as a structure of arrays, with
+            all the x components in one aligned array and all the y components in another. Loops
+            over the particles can then be vectorised, and passes which only need one of the
+            components only have to read half of the data.
+         */
+        
+        AlignedArray x, y;
+        
+        int size() const;
+        void resize(int n);
+        void clear();
+        
+        coord get(int i) const;         // return the components of particle i as a coord
+        void set(int i, coord value);   // set the components of particle i
+        
+        void push_back(coord value);    // add a new particle at the end
+        void pop_back();                // remove the last particle
+    };
+    
+    class TrailHistory
+    {
+        /*
+            Stores the positions of the particles in the last few frames, for drawing trails, as a
+            ring buffer of frames. All the frames live in one pair of aligned arrays, with frame
+            slot s holding its x components in x[s * width] to x[s * width + width - 1], and the same
+            for y. Saving a frame just copies the positions into the oldest slot and moves head
+            on, so once the buffer is big enough for the number of particles, no memory is
+            allocated or freed.
+         
+            A copy can be kept up to date with copyNewFrames, which only copies the frames pushed
+            since the copy was last brought up to date, as long as the slots have not been cleared
+            or resized in between.
+         */
+        
+    private:
+        int capacity;            // Number of frames which can be stored
+        int count;               // Number of frames currently stored
+        int head;                // Slot of the most recent frame
+        int width;               // Number of particles there is room for in each slot
+        AlignedArray x, y;
+        std::vector <int> frameN; // Number of particles stored in each slot
+        std::uint64_t pushes;    // Number of frames ever pushed
+        std::uint64_t resets;    // Number of times the slots have been cleared or resized
+        
+        int slot(int nstep) const; // slot of the frame nstep frames ago
+        
+    public:
+        TrailHistory(int capacity = 20);
+        
+        int getCapacity() const;
+        void setCapacity(int capacity); // also clears the history
+        
+        int size() const;
+        void clear();
+        
+        // save a new frame, overwriting the oldest if the buffer is full
+        void push(const ParticleArray &positions);
+        
+        // true if particle i was in the frame nstep frames ago, and its position then
+        bool has(int i, int nstep) const;
+        coord get(int i, int nstep) const;
+        
+        // make this, which must be a copy of source, the same as source again, copying only the
+        // frames pushed to source since then, or the whole of source if they can't be told apart
+        void copyNewFrames(const TrailHistory &source);
+    };
 
+    // Available integrators: plain velocity Verlet, or the r-RESPA multiple time step integrator
+    enum Integrator { VELOCITY_VERLET, RESPA };
+    
+    // Which pair forces to calculate: all of them, or for RESPA the fast or slow part
+    enum PairRange { ALL_PAIRS, FAST_PAIRS, SLOW_PAIRS };
+    
+    // Sums and maxima over the particles, made as their velocities are updated in a kick
+    struct KickSums
+    {
+        double v2;    // sum of squared speeds
+        double vabs;  // sum of |vx| + |vy|
+        double fmax2; // largest squared force
+        double vmax2; // largest squared speed
+    };
+    
+    // Totals over the steps taken since the statistics were last reset, where a step is one call
+    // to integrate, and so a whole outer step under RESPA
+    struct StepStats
+    {
+        long long steps;      // number of steps taken
+        double time;          // simulated time covered by them
+        double dtSum;         // sum of the time steps dt used, which are the inner steps under RESPA
+        double dtMin, dtMax;  // smallest and largest dt used
+    };
+    
+    class RadialDistribution
+    {
+        /*
+            Histogram of the separations of pairs of particles between min and max, summed over
+            any number of frames.
+         
+            Each frame is binned straight from the positions, without storing the distances. The
+            particles are sorted into a grid of cells at least max wide, so that only pairs in the
+            same or neighbouring cells need to be looked at, and each pair is looked at once. The
+            work can be split between the threads of a pool by rows of cells, with each thread
+            binning into its own histogram, which are added together at the end of the frame.
+         */
+        
+    private:
+        double min, max;
+        int bins;
+        std::vector <double> counts;       // number of pairs in each bin, over all the frames
+        int nframes;                       // number of frames accumulated
+        
+        // scratch space kept between frames: the cell grid, as linked lists like the one in
+        // MDContainer, and the histogram of each thread
+        std::vector <int> cellHead, cellNext;
+        std::vector <std::vector <double>> threadCounts;
+        
+    public:
+        RadialDistribution(double min = 0, double max = 3, int bins = 100);
+        
+        void setRange(double min, double max, int bins); // also clears the histogram
+        void clear();
+        
+        // add the pairs of the first N particles in positions, on the threads of pool if given
+        void accumulate(const ParticleArray &positions, int N, ThreadPool *pool = nullptr);
+        
+        int getNFrames() const;
+        const std::vector <double>& getCounts() const;
+        std::vector <double> getHistogram() const; // normalised so that the bins sum to one
+    };
+    
+    // Histograms of the separations of the first N particles in positions, and of the speeds of
+    // the first N particles in velocities, with the given number of bins between min and max;
+    // the speeds are binned on the threads of pool if one is given
+    std::vector <double> separationHistogram(const ParticleArray &positions, int N, double min, double max, int bins);
+    std::vector <double> speedHistogram(const ParticleArray &velocities, int N, double min, double max, int bins, ThreadPool *pool = nullptr);
+    
+    struct Snapshot
+    {
+        /*
+            A copy of everything needed to draw an MDContainer at one moment: the particles, their
+            trails, and the energies. When the simulation runs on a thread of its own, it publishes
+            a snapshot after every update, and the drawing code reads the latest one, which does
+            not change while it is being read, instead of the system itself.
+         */
+        
+        int N;
+        coord box;
+        ParticleArray positions, velocities, forces;
+        TrailHistory prevPositions;
+        util::SlidingWindow prevEPot, prevEKin;
+        double epot, ekin, v_avg;
+        std::vector <double> speedDistribution; // MDContainer::getSpeedDistribution when published
+        
+        Snapshot();
+        
+        // The same as the MDContainer getters of the same names
+        int getN() const;
+        coord getBox() const;
+        double getWidth() const;
+        double getHeight() const;
+        double getVAvg() const;
+        
+        coord getPos(int i) const;
+        coord getVel(int i) const;
+        coord getForce(int i) const;
+        coord getPos(int i, int nstep) const;
+        int getNPrevPos() const;
+        
+        double getEPot() const;
+        double getEKin() const;
+        double getMaxEpot() const;
+        double getMaxEkin() const;
+        double getMinEpot() const;
+        double getMinEkin() const;
+        const util::SlidingWindow& getEpotHistory() const;
+        const util::SlidingWindow& getEkinHistory() const;
+        const std::vector <double>& getSpeedDistribution() const;
+        
+        std::vector <double> rdf(double min, double max, int bins) const;
+        std::vector <double> maxwell(double min, double max, int bins) const;
+    };
+    
+    class TrajectoryWriter;
+    
     class MDContainer
     {
     private:
@@ -43,27 +233,88 @@ namespace md{
         int NAfterReset; // Number of particles to be used when the system is reset
         
         // Matrices of dynamical variables
-        std::vector <coord> positions, velocities, forces;
-        
-        // Store the last twenty position matrices for animating trails
-        std::deque <std::vector <coord>> prevPositions;
-        
-        // Deques of the potential and kinetic energies for drawing graphs
-        std::deque <double> prevEPot, prevEKin;
+        ParticleArray positions, velocities, forces;
+        
+        // For RESPA, forces only holds the fast part of the forces, and the slow part is here
+        ParticleArray slowForces;
+        bool slowForcesValid; // false if the slow forces must be recalculated before they are used
+        
+        // Integrator settings: for RESPA, the number of inner steps of dt per outer step, and the
+        // distance beyond which pair forces are treated as slow
+        Integrator integrator;
+        int respaSteps;
+        double respaSplit;
+        
+        // Store the last few frames of positions for animating trails
+        TrailHistory prevPositions;
+        
+        // Snapshots of the system passed from the thread running it to the thread drawing it
+        util::TripleBuffer <Snapshot> snapshots;
+        
+        // Sliding windows of the potential and kinetic energies for drawing graphs, and the time
+        // steps, which also keep track of the minimum and maximum energies over the window
+        util::SlidingWindow prevEPot, prevEKin, prevDt;
+        
+        // Histogram of the speeds, from 0 to speedHistMax, binned as the velocities are updated in
+        // the last kick of each step, by each thread into its own counts, which are then added
+        // together; and the running sum of the counts over the last few updates, for the
+        // Maxwell-Boltzmann graph
+        double speedHistMax;
+        std::vector <double> speedCounts;
+        std::vector <std::vector <double>> threadSpeedCounts;
+        bool speedCountsFresh; // true if speedCounts is from a step not yet saved in speedHistory
+        util::RunningHistogram speedHistory;
         
         // Vector of the simulation box dimensions: width, height
         coord box_dimensions;
         
+        // Linked-cell index of the particles, rebuilt with the neighbour list, so that the
+        // pair search only needs to look at particles in the same or neighbouring cells
+        int ncellx, ncelly;          // Number of cells in the x and y directions
+        coord cell_dimensions;       // Width and height of each cell, at least rcutoff + skin
+        std::vector <int> cellHead;  // Index of the first particle in each cell, -1 if empty
+        std::vector <int> cellNext;  // Index of the next particle in the same cell, -1 at the end
+        
+        // Verlet neighbour list of all pairs within rcutoff + skin, stored so that the neighbours
+        // of i are neighbourList[neighbourStart[i]] to neighbourList[neighbourStart[i+1] - 1].
+        // A half list stores each pair once, under i for j > i; a full list stores it under both
+        // i and j, so that each thread only ever writes to the forces on its own particles.
+        std::vector <int> neighbourStart, neighbourList;
+        ParticleArray listPositions;       // Positions when the neighbour list was last built
+        bool listValid;                    // false if the list must be rebuilt before the next use
+        bool fullList;                     // true if the current list is a full list
+        double skin;                       // Extra distance beyond rcutoff included in the list
+        int nRebuilds, nListSteps;         // Number of list rebuilds and force calculations since last reset
+        
+        // Short list of the pairs within respaSplit + skin, in the same layout, for the fast RESPA forces
+        std::vector <int> fastStart, fastList;
+        ParticleArray fastListPositions;   // Positions when the short list was last built
+        bool fastListValid;                // false if the short list must be rebuilt before the next use
+        
         // Array of external Gaussian potentials
         std::vector<Gaussian> gaussians;
         
         double epot, ekin; // Potential and kinetic energies
         double rcutoff;    // Cutoff radius for pair potential
         double dt, T;      // MD timestep and desired temperature
+        
+        // Adaptive time step: when on, dt is picked each step from the largest force and speed in
+        // the last kick (maxForce2 and maxSpeed2, squared, or negative if not yet known)
+        bool adaptiveDt;
+        double fixedDt;                 // dt last set by setTimestep, used when adaptiveDt is off
+        double dtMin, dtMax;            // bounds on dt
+        double maxStep;                 // largest distance a particle should move in one step
+        double dtGrowth, dtShrink;      // largest factors by which dt can change in one step
+        double maxForce2, maxSpeed2;
+        StepStats stepStats;            // the time steps taken since the last reset
         double freq;       // thermostat frequency
         
-        double maxEKin, maxEPot, minEKin, minEPot; // Maximum/minimum kinetic and potential energies in prevEPot, prevEKin
         double v_avg; // Current average speed of particles
+        double sumAbsVel; // Sum of |vx| + |vy| over the particles, from the last kick
+        
+        // Berendsen rescaling of the velocities which is still to be applied, and is folded into
+        // the next drift rather than needing a pass of its own
+        double velocityScale;
         
         // Default potential is Lennard-Jones
         LennardJones lj;
@@ -74,6 +325,25 @@ namespace md{
         // Reference to the potential functor to be used to calculate the forces
         PotentialFunctor* potential;
         
+        // The pair force kernels, forcesThread instantiated for the concrete type of potential,
+        // for each PairRange
+        void (MDContainer::*pairForces[3])(int start, int end, ParticleArray& target, double& etemp);
+        
+        // Worker threads for the force calculation, kept alive between time steps
+        ThreadPool pool;
+        
+        // Wall-clock time in seconds taken by each thread in the last pair force calculation
+        std::vector <double> threadTimes;
+        
+        // Writer given every step as the system runs, to save a trajectory, or nullptr
+        TrajectoryWriter *trajectory;
+        
+        // Random number generator for the thermostat and initial velocities, and the number
+        // of draws taken from it so far
+        util::CounterRNG rng;
+        std::uint64_t rngDraws;
+        std::uint64_t nextDraw();
+        
     public:
         MDContainer(); // Default constructor
         
@@ -82,6 +352,12 @@ namespace md{
         void toggleRunning();            // toggle whether the system is running
         void resetSystem();              // Clears the system & regrids everything
         
+        // Save the whole state of the system to a checkpoint file, or replace it with the state
+        // saved in one, so that a run can be carried on later (see checkpoint.hpp for the format)
+        // both return false on failure, and a failed load leaves the system unchanged
+        bool saveCheckpoint(const std::string &path) const;
+        bool loadCheckpoint(const std::string &path);
+        
         // Accessors
         // Getters
         
@@ -94,6 +370,7 @@ namespace md{
         
         double getTimestep() const;
         double getCutoff() const;
+        double getSkin() const;
         double getFreq() const;
         
         coord  getBox() const;
@@ -112,18 +389,75 @@ namespace md{
         int getNEnergies() const;
         int getNPrevPos() const;
         
+        // Return neighbour list statistics, for tuning the skin
+        int getNRebuilds() const;
+        int getNListSteps() const;
+        void resetListStats();
+        
+        // Return the number of distinct pairs in the current neighbour list
+        int getNListPairs() const;
+        
+        // Return the time taken by thread t in the last pair force calculation, and the ratio
+        // of the slowest thread's time to the mean, which is 1 for perfectly balanced threads
+        int    getNThreadTimes() const;
+        double getThreadTime(int t) const;
+        double getLoadImbalance() const;
+        
+        // Return the positions and velocities of all the particles at once
+        const ParticleArray& getPositions() const;
+        const ParticleArray& getVelocities() const;
+        
         // Return struct of dynamical variables of particle i
         coord getPos(int i) const;
         coord getVel(int i) const;
         coord getForce(int i) const;
         
-        // Return position struct of particle i nstep frames ago
+        // Return position struct of particle i nstep frames ago, or its current position if it
+        // has been added since then
         coord getPos(int i, int nstep) const;
         
+        // Number of frames kept for trails
+        int getTrailLength() const;
+        void setTrailLength(int nframes);
+        
         // Return energy nstep frames ago
         double getPreviousEpot(int nstep) const;
         double getPreviousEkin(int nstep) const;
         
+        // Return the whole energy histories, e.g. for a downsampled view
+        const util::SlidingWindow& getEpotHistory() const;
+        const util::SlidingWindow& getEkinHistory() const;
+        
+        // Number of frames of energies and time steps kept (120 by default); changing it clears
+        // the histories
+        int getEnergyHistoryLength() const;
+        void setEnergyHistoryLength(int nframes);
+        
+        // The speed distribution averaged over the last few updates, normalised so the bins sum to
+        // one, or that of the current velocities if there have been no updates since a reset.
+        // The speeds from 0 to max are split into bins (10 and 100 by default), and nframes
+        // updates (40 by default) are averaged over; changing them clears the average
+        std::vector <double> getSpeedDistribution() const;
+        void setSpeedHistogram(double max, int bins, int nframes);
+        
+        // Return the time step nstep frames ago
+        double getPreviousTimestep(int nstep) const;
+        
+        // Start or stop passing every step to a trajectory writer, which is not owned by the
+        // system; nullptr stops it
+        void setTrajectory(TrajectoryWriter *writer);
+        TrajectoryWriter* getTrajectory() const;
+        
+        // Copy the current state into a snapshot and publish it; to be called by the thread
+        // which runs the system, between updates
+        void publishSnapshot();
+        
+        // Move on to the most recently published snapshot, returning false if there is none newer,
+        // and return the current one; to be called by the thread which draws the system, once per
+        // frame, so that everything drawn in a frame comes from the same snapshot
+        bool acquireSnapshot();
+        const Snapshot& getSnapshot() const;
+        
         // Get a reference to or details of the ith Gaussian
         Gaussian& getGaussian(int i);
         double getGaussianAlpha(int i) const;
@@ -145,14 +479,46 @@ namespace md{
         // Set basic system constants
         void setBox(double box_width, double box_height);
         void setCutoff(double cutoff);
+        void setSkin(double skin);
         void setTimestep(double timestep);
         void setTemp(double temperature);
         void setFreq(double frequency);
         
+        // Switch the adaptive time step on or off, with bounds on dt, the largest distance a particle
+        // may move in a step, and the largest factors by which dt may grow or shrink in a step
+        void setAdaptiveTimestep(bool on, double dtMin = 0.0005, double dtMax = 0.008, double maxStep = 0.015,
+                                 double growth = 1.05, double shrink = 0.5);
+        bool getAdaptiveTimestep() const;
+        
+        // Statistics of the steps taken since the last reset of the system or of the statistics,
+        // e.g. the mean dt achieved in adaptive mode, and the simulated time covered
+        StepStats getStepStats() const;
+        void resetStepStats();
+        
+        // Choose the integrator, and for RESPA the number of inner steps and the split distance
+        void setIntegrator(Integrator integrator, int nsteps = 4, double split = 2.0);
+        Integrator getIntegrator() const;
+        int getRespaSteps() const;
+        double getRespaSplit() const;
+        
+        // The time advanced by one call to integrate, which is a whole outer step under RESPA
+        double getStepTime() const;
+        
+        // Width of the region below respaSplit over which pair forces switch from fast to slow
+        constexpr static const double RESPA_SWITCH_WIDTH = 0.3;
+        
+        // Set the random seed, so that runs are reproducible
+        void setSeed(std::uint64_t seed);
+        std::uint64_t getSeed() const;
+        
         // Set the potential
         void setPotential(PotentialFunctor* _potential);
         void setPotential(Potential potential);
         
+        // Evaluate the pair potentials by interpolating from a table rather than directly
+        void setTabulated(bool on, TableInterpolation interpolation = TABLE_AUTO, int size = 4096);
+        bool getTabulated() const;
+        
         // Add and remove particles
         void addParticle(double x, double y, double vx, double vy);
         void addParticle(coord pos, coord vel);
@@ -164,14 +530,39 @@ namespace md{
         void removeGaussian(int i = 0);
         void updateGaussian(int i, double gAmp, double gAlpha, double gex0, double gey0);
 
+        // Rebuild the linked-cell index from the current positions
+        void buildCells(double rlist);
+        int cellIndex(int cx, int cy) const;
+        int cellX(double x) const;
+        int cellY(double y) const;
+        
+        // Rebuild the neighbour list if it is invalid, or any particle has moved more than skin / 2
+        // full chooses between a full and a half list, and the list is rebuilt if this changes
+        bool listNeedsRebuild(bool full) const;
+        bool movedTooFar(const ParticleArray& saved) const;
+        void buildNeighbourList(bool full);
+        void buildFastList();
+        
         // Calculate forces and energies
+        void choosePairForces();
+        template <class Functor>
+        void setPairForces();
         void forcesEnergies(int nthreads);
-        void externalForce();
-        void forcesThread(int start, int end, std::vector<coord>& ftemp,
-                double& etemp, std::vector<coord> postemp);
+        void computeForces(int nthreads, PairRange range = ALL_PAIRS);
+        void externalForce(int start, int end, ParticleArray& target, double& etemp);
+        template <class Functor, int Range>
+        void forcesThread(int start, int end, ParticleArray& target, double& etemp);
+        double respaSwitch(double r) const;
         
-        // Main MD integration step
+        // Main MD integration step, its two halves for particles start to end, and the RESPA step
         void integrate(int nthreads);
+        void integrateRespa(int nthreads);
+        void drift(int start, int end, double scale);
+        void kick(int start, int end, const ParticleArray& f, double hdt, KickSums& sums, double* speedHist = nullptr);
+        KickSums kickAll(int nthreads, const ParticleArray& f, double hdt, bool binSpeeds = false);
+        void countStep(); // add the step just taken to stepStats
+        void flushVelocityScale();
+        void adaptTimestep();
         
         // save positions and energies in prevPos, prevEPot, prevEKin
         void savePreviousValues();
@@ -182,13 +573,16 @@ namespace md{
         // calculate the radial distribution function
         std::vector <double> rdf(double min, double max, int bins) const;
 
+        // add the current separations to a radial distribution, using the thread pool
+        void accumulateRdf(RadialDistribution &distribution);
+
         // calculate the speed distribution (Maxwell-Boltzmann)
         std::vector <double> maxwell(double min, double max, int bins) const;
 
         // Thermostats
-        coord randomVel() const;
-        void andersen(double freq);
-        void berendsen(double freq);
+        coord randomVel(int i, std::uint64_t draw) const;
+        void andersen(double freq, double step);
+        void berendsen(double freq, double step);
     };
 }
 
@@ -0,0 +1,99 @@
+/*
+ Argon
+ 
+ Copyright (c) 2016 David McDonagh, Robert Shaw, Staszek Welsh
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include "physicsthread.hpp"
+#include <chrono>
+
+namespace md {
+    
+    PhysicsThread::PhysicsThread(MDContainer &_system) : system(_system), stopping(false), tickRate(60), nthreads(1) {}
+    
+    PhysicsThread::~PhysicsThread() { stop(); }
+    
+    /*
+        ROUTINE start:
+            Publishes a first snapshot, so that there is something to draw straight away, and
+            then starts the thread. Does nothing if the thread is already running.
+     */
+    void PhysicsThread::start(int _nthreads, double _tickRate) {
+        if (isActive()) { return; }
+        
+        nthreads = _nthreads;
+        setTickRate(_tickRate);
+        
+        {
+            std::lock_guard <std::mutex> guard(mutex);
+            system.publishSnapshot();
+        }
+        
+        stopping = false;
+        thread = std::thread(&PhysicsThread::loop, this);
+    }
+    
+    void PhysicsThread::stop() {
+        if (!isActive()) { return; }
+        stopping = true;
+        thread.join();
+    }
+    
+    bool PhysicsThread::isActive() const { return thread.joinable(); }
+    
+    double PhysicsThread::getTickRate() const { return tickRate; }
+    void PhysicsThread::setTickRate(double _tickRate) { tickRate = _tickRate > 0 ? _tickRate : 0; }
+    
+    void PhysicsThread::lock()   { mutex.lock(); }
+    void PhysicsThread::unlock() { mutex.unlock(); }
+    
+    /*
+        ROUTINE loop:
+            Runs the system and publishes a snapshot, then sleeps until the next tick. If a tick
+            takes longer than the time between ticks, the next one starts straight away, but
+            the missed ticks are not made up, so the simulation slows down rather than stalling
+            everything else trying to catch up. The snapshot is published even when the system
+            is paused, so that changes made while it is paused are still shown.
+     */
+    void PhysicsThread::loop() {
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point next = Clock::now();
+        
+        while (!stopping) {
+            {
+                std::lock_guard <std::mutex> guard(mutex);
+                system.run(nthreads);
+                system.publishSnapshot();
+            }
+            
+            double rate = tickRate;
+            if (rate > 0) {
+                next += std::chrono::duration_cast <Clock::duration> (std::chrono::duration <double> (1.0 / rate));
+                Clock::time_point now = Clock::now();
+                if (next < now) { next = now; }
+                else { std::this_thread::sleep_until(next); }
+            } else {
+                std::this_thread::yield(); // give anything waiting for the lock a chance
+            }
+        }
+    }
+}
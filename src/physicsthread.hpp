@@ -0,0 +1,84 @@
+/*
+ Argon
+ 
+ Copyright (c) 2016 David McDonagh, Robert Shaw, Staszek Welsh
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef physicsthread_hpp
+#define physicsthread_hpp
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "mdforces.hpp"
+
+namespace md {
+    
+    class PhysicsThread
+    {
+        /*
+            Runs an MDContainer on a thread of its own, so that the simulation does not have to
+            wait for frames to be drawn, and a slow frame does not hold up the simulation.
+         
+            Every tick, the thread calls run() on the system, i.e. stepsPerUpdate time steps, and
+            then publishes a snapshot of it, which the drawing code reads with acquireSnapshot()
+            and getSnapshot() without taking any lock. Ticks happen tickRate times a second, or
+            back to back if tickRate is zero.
+         
+            Anything else which reads or changes the live system must hold the lock, which the
+            thread holds while it runs the system, e.g.
+                std::lock_guard <md::PhysicsThread> guard(physicsThread);
+         */
+        
+    private:
+        MDContainer &system;
+        
+        std::thread thread;
+        std::mutex mutex;               // held while the system is being run
+        std::atomic <bool> stopping;    // set to tell the thread to exit
+        std::atomic <double> tickRate;  // ticks per second, or zero for as many as possible
+        int nthreads;                   // threads for the force calculation
+        
+        void loop();                    // main loop of the thread
+        
+    public:
+        PhysicsThread(MDContainer &system);
+        ~PhysicsThread();
+        
+        // The thread cannot be copied
+        PhysicsThread(const PhysicsThread &other) = delete;
+        PhysicsThread& operator=(const PhysicsThread &other) = delete;
+        
+        // Start running the system, with nthreads threads for the forces, or stop and join the thread
+        void start(int nthreads, double tickRate = 60);
+        void stop();
+        bool isActive() const;
+        
+        double getTickRate() const;
+        void setTickRate(double tickRate);
+        
+        // Hold the thread between ticks, so that the system can be changed safely
+        void lock();
+        void unlock();
+    };
+}
+
+#endif /* physicsthread_hpp */
@@ -121,26 +121,19 @@ union rect
         rectangle, and various methods are given to get the width, height, centre, etc.
      */
     
+    // the corners are available as coords through getPos(POS_TOP_LEFT) and getPos(POS_BOTTOM_RIGHT);
+    // they are not members of the union, as a coord has a constructor, which gcc does not allow
+    // in an anonymous struct
     struct {
         union {
-            coord min;
-            struct {
-                union {
-                    double left;
-                    double x;
-                };
-                union {
-                    double top;
-                    double y;
-                };
-            };
+            double left;
+            double x;
         };
         union {
-            coord max;
-            struct {
-                double right, bottom;
-            };
+            double top;
+            double y;
         };
+        double right, bottom;
     };
     double elem[4];
     
@@ -306,6 +299,7 @@ void setScissorClip(); // overload with no arguments disables the scissor clip
 int windowWidth();      // width of window
 int windowHeight();     // height of window
 double timeElapsed();   // time since program began in seconds
+std::string dataPath(const std::string &filename); // path to a file in the app's data folder
 
 // Implemented in platform.cpp
 coord windowSize();     // width and height of window
@@ -70,3 +70,5 @@ int windowHeight() { return ofGetHeight(); }
 
 double timeElapsed() { return ofGetElapsedTimef(); }
 
+std::string dataPath(const std::string &filename) { return ofToDataPath(filename, true); }
+
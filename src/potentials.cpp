@@ -23,13 +23,13 @@
  */
 
 #include "potentials.hpp"
-#include "gui_derived.hpp"
 
 
 //------ POTENTIALFUNCTOR -----
 
 // constructor
-PotentialFunctor::PotentialFunctor(Potential _type) : type(_type) {}
+PotentialFunctor::PotentialFunctor(Potential _type) : type(_type), tabulated(false), tableDirty(true),
+    tableInterpolation(TABLE_AUTO), tableSize(4096) {}
 
 // return the potential
 // if within the wall, use the LJ potential
@@ -63,11 +63,157 @@ double PotentialFunctor::calcForceLJ(double r) {
     return 24 * r * (rm6 - 2 * rm6 * rm6);
 }
 
+// LJ energy and force / r, from r^2
+EnergyForce PotentialFunctor::evaluateLJ(double r2) const {
+    double rm2 = 1.0 / r2;
+    double rm6 = rm2 * rm2 * rm2; // r^(-6)
+    EnergyForce ef = { 4 * (rm6 * rm6 - rm6), 24 * (rm6 - 2 * rm6 * rm6) };
+    return ef;
+}
+
+// Energy and force / r through potential() and force()
+EnergyForce PotentialFunctor::evaluate(double r2) {
+    double r = sqrt(r2);
+    EnergyForce ef = { potential(r), force(r) / r };
+    return ef;
+}
+
 // Get type
 Potential PotentialFunctor::getType() const {
     return type;
 }
 
+// Energy and force / r for a block of pairs, one pair at a time, or from the table in table mode
+void PotentialFunctor::evaluateBlock(const double *r2, double *energy, double *forceOverR, int m, double rcut2) {
+    evaluateEach(*this, r2, energy, forceOverR, m, rcut2);
+}
+
+// Switch table mode on or off
+// the table is not sampled until it is next needed
+void PotentialFunctor::setTabulated(bool on, TableInterpolation interpolation, int size) {
+    tabulated = on;
+    if (interpolation != tableInterpolation || size != tableSize) {
+        tableInterpolation = interpolation;
+        tableSize = size > 1 ? size : 4096;
+        invalidateTable();
+    }
+}
+
+bool PotentialFunctor::isTabulated() const { return tabulated; }
+TableInterpolation PotentialFunctor::getTableInterpolation() const { return tableInterpolation; }
+int PotentialFunctor::getTableSize() const { return tableSize; }
+
+void PotentialFunctor::invalidateTable() { tableDirty = true; }
+
+// Cubic interpolation for a smooth potential, but linear for one with jumps unless asked otherwise
+TableInterpolation PotentialFunctor::resolvedInterpolation() const {
+    if (tableInterpolation != TABLE_AUTO) { return tableInterpolation; }
+    return tableBreaks.empty() ? TABLE_CUBIC : TABLE_LINEAR;
+}
+
+// Sample the energy and force(r) / r on the r^2 grid, if the table is out of date
+// the intervals are shared between the segments in proportion to their lengths, and point j of a
+// segment is at r^2 = r2Start + (j - 1) * dr2, for j = 0 to size + 2
+void PotentialFunctor::updateTable() {
+    if (!tableDirty) { return; }
+    
+    // the segments run from TABLE_R2_MIN to TABLE_R2_MAX, split at each jump in between
+    double r2Min = TABLE_R2_MIN, r2Max = TABLE_R2_MAX;
+    std::vector <double> edges(1, r2Min);
+    for (double r : tableBreaks) {
+        if (r * r > edges.back() && r * r < r2Max) { edges.push_back(r * r); }
+    }
+    edges.push_back(r2Max);
+    
+    int nsegments = edges.size() - 1;
+    tableSegments.resize(nsegments);
+    tableEnergy.clear();
+    tableForce.clear();
+    for (int g = 0; g < nsegments; ++g) {
+        TableSegment &seg = tableSegments[g];
+        seg.r2Start = edges[g];
+        seg.r2End = edges[g+1];
+        seg.size = std::max(1, (int)std::lround(tableSize * (seg.r2End - seg.r2Start) / (r2Max - r2Min)));
+        seg.dr2 = (seg.r2End - seg.r2Start) / seg.size;
+        seg.invDr2 = 1.0 / seg.dr2;
+        seg.first = tableEnergy.size();
+        
+        // at a jump, the end point is sampled just inside the segment, to take the limit from
+        // this side, and the extra point beyond it is extrapolated rather than sampled from the
+        // far side of the jump
+        bool jumpBefore = g > 0, jumpAfter = g < nsegments - 1;
+        double nudge = 1e-9 * seg.dr2;
+        for (int j = 0; j < seg.size + 3; ++j) {
+            double r2 = seg.r2Start + (j - 1) * seg.dr2;
+            if (jumpBefore && j == 1) { r2 += nudge; }
+            if (jumpAfter && j == seg.size + 1) { r2 -= nudge; }
+            
+            EnergyForce ef = evaluate(r2);
+            tableEnergy.push_back(ef.energy);
+            tableForce.push_back(ef.forceOverR);
+        }
+        
+        double *e = &tableEnergy[seg.first], *f = &tableForce[seg.first];
+        int last = seg.size + 2;
+        if (jumpBefore) {
+            e[0] = 2 * e[1] - e[2];
+            f[0] = 2 * f[1] - f[2];
+        }
+        if (jumpAfter) {
+            e[last] = 2 * e[last-1] - e[last-2];
+            f[last] = 2 * f[last-1] - f[last-2];
+        }
+    }
+    
+    tableDirty = false;
+}
+
+// Energy and force / r for a block of pairs, interpolated from the table
+// every pair costs the same, whatever the potential
+void PotentialFunctor::evaluateTableBlock(const double *r2, double *energy, double *forceOverR, int m, double rcut2) const {
+    const double *te = tableEnergy.data(), *tf = tableForce.data();
+    const TableSegment *segments = tableSegments.data();
+    bool linear = resolvedInterpolation() == TABLE_LINEAR;
+    
+    for (int k = 0; k < m; ++k) {
+        if (r2[k] >= rcut2 || r2[k] >= TABLE_R2_MAX) {
+            energy[k] = 0;
+            forceOverR[k] = 0;
+        } else if (r2[k] < TABLE_R2_MIN) {
+            // below the start of the table every potential is the LJ wall, so evaluate it directly
+            EnergyForce ef = evaluateLJ(r2[k]);
+            energy[k] = ef.energy;
+            forceOverR[k] = ef.forceOverR;
+        } else {
+            // find the segment, which is the only one for a smooth potential, as the last one
+            // ends at TABLE_R2_MAX
+            const TableSegment *seg = segments;
+            while (r2[k] >= seg->r2End) { ++seg; }
+            
+            // interval s is between points s + 1 and s + 2 of the segment, and t is the fraction
+            // of the way along it
+            double x = (r2[k] - seg->r2Start) * seg->invDr2;
+            int s = std::min((int)x, seg->size - 1);
+            double t = x - s;
+            const double *e = te + seg->first + s, *f = tf + seg->first + s;
+            
+            if (linear) {
+                energy[k] = e[1] + t * (e[2] - e[1]);
+                forceOverR[k] = f[1] + t * (f[2] - f[1]);
+            } else {
+                // Catmull-Rom spline through points s to s + 3
+                double t2 = t * t, t3 = t2 * t;
+                double w0 = -0.5 * t3 + t2 - 0.5 * t;
+                double w1 = 1.5 * t3 - 2.5 * t2 + 1;
+                double w2 = -1.5 * t3 + 2 * t2 + 0.5 * t;
+                double w3 = 0.5 * t3 - 0.5 * t2;
+                energy[k] = w0 * e[0] + w1 * e[1] + w2 * e[2] + w3 * e[3];
+                forceOverR[k] = w0 * f[0] + w1 * f[1] + w2 * f[2] + w3 * f[3];
+            }
+        }
+    }
+}
+
 
 //------ LENNARD-JONES POTENTIAL -----
 
@@ -80,6 +226,26 @@ double LennardJones::calcEnergy(double r) { return calcEnergyLJ(r); }
 // Force calculation
 double LennardJones::calcForce(double r) { return calcForceLJ(r); }
 
+// Energy and force / r, zero past the cutoff of 3.0
+EnergyForce LennardJones::evaluate(double r2) {
+    if (r2 > 9.0) { EnergyForce zero = {0, 0}; return zero; }
+    return evaluateLJ(r2);
+}
+
+// Energy and force / r for a block of pairs, written in terms of r^2 only
+// the same as calcEnergyLJ and calcForceLJ / r, with zero past the cutoff of 3.0
+// the loop has no branches so that it can be vectorised
+void LennardJones::evaluateBlock(const double *r2, double *energy, double *forceOverR, int m, double rcut2) {
+    double cut2 = rcut2 < 9.0 ? rcut2 : 9.0;
+    for (int k = 0; k < m; ++k) {
+        double rm2 = 1.0 / r2[k];
+        double rm6 = rm2 * rm2 * rm2; // r^(-6)
+        bool inside = r2[k] < cut2;
+        energy[k]     = inside ? 4 * (rm6 * rm6 - rm6) : 0;
+        forceOverR[k] = inside ? 24 * (rm6 - 2 * rm6 * rm6) : 0;
+    }
+}
+
 
 
 //------ MORSE POTENTIAL ------
@@ -122,11 +288,42 @@ double Morse::calcForce(double r)
 }
 
 
+// Morse energy and force / r together, sharing the exponential and the lerp to the LJ wall
+EnergyForce Morse::evaluate(double r2)
+{
+    EnergyForce ef = {0, 0};
+    if (r2 > 9.0) { return ef; }
+    if (r2 < LJ_AT_3 * LJ_AT_3) { return evaluateLJ(r2); }
+    
+    double r = sqrt(r2);
+    double exponential = exp(-a * (r - r_eq));
+    double omExp = 1.0 - exponential;
+    ef.energy = omExp * omExp - 1;
+    ef.forceOverR = 2 * a * omExp * exponential / r;
+    
+    if (r < LJ_AT_2) {
+        EnergyForce lj = evaluateLJ(r2);
+        double t = (r - LJ_AT_3) / (LJ_AT_2 - LJ_AT_3);
+        ef.energy = t * ef.energy + (1 - t) * lj.energy;
+        ef.forceOverR = t * ef.forceOverR + (1 - t) * lj.forceOverR;
+    }
+    return ef;
+}
+
+// Energy and force / r for a block of pairs, with evaluate() called directly
+void Morse::evaluateBlock(const double *r2, double *energy, double *forceOverR, int m, double rcut2) {
+    evaluateEach(*this, r2, energy, forceOverR, m, rcut2);
+}
+
 
 //------ SQUARE WELL POTENTIAL -----
 
 // Constructor, sets default values of parameters
-SquareWell::SquareWell() : lambda(1.85), PotentialFunctor(SQUARE_WELL) {}
+// the energy jumps where the steep wall meets the LJ wall, and the force at r = 1, lambda and the
+// end of the ramp after lambda
+SquareWell::SquareWell() : lambda(1.85), PotentialFunctor(SQUARE_WELL) {
+    tableBreaks = {LJ_AT_3, 1.0, lambda, lambda + 0.015};
+}
 
 // Square well potential
 double SquareWell::calcEnergy(double r)
@@ -151,6 +348,31 @@ double SquareWell::calcForce(double r)
     return force;
 }
 
+// Square well energy and force / r together, with one pass through the branches
+EnergyForce SquareWell::evaluate(double r2)
+{
+    EnergyForce ef = {0, 0};
+    if (r2 > 9.0) { return ef; }
+    if (r2 < LJ_AT_3 * LJ_AT_3) { return evaluateLJ(r2); }
+    
+    double r = sqrt(r2);
+    if ( r < 1.0 ) { // steep wall approximation to a hard wall
+        ef.energy = -1 + (r - 1.0) * LJ_F_3;
+        ef.forceOverR = LJ_F_3 / r;
+    } else if ( r < lambda ) {
+        ef.energy = -1;
+    } else if ( r < lambda + 0.015 ) {
+        ef.energy = (r - lambda) / 0.015 - 1;
+        if ( lambda < r ) { ef.forceOverR = 1 / (0.015 * r); }
+    }
+    return ef;
+}
+
+// Energy and force / r for a block of pairs, with evaluate() called directly
+void SquareWell::evaluateBlock(const double *r2, double *energy, double *forceOverR, int m, double rcut2) {
+    evaluateEach(*this, r2, energy, forceOverR, m, rcut2);
+}
+
 
 
 //------ CUSTOM POTENTIAL ------
@@ -169,10 +391,30 @@ CustomPotential::CustomPotential() : PotentialFunctor(CUSTOM) {
 // Get a reference to the spline
 cubic::Spline& CustomPotential::getSpline() { return spline; }
 
+// Get the control points, not including the fixed ones
+const std::vector <cubic::Point>& CustomPotential::getPoints() const { return controlPoints; }
+
 // return the potential
 double CustomPotential::calcEnergy(double r) { return spline.value(r); }
 double CustomPotential::calcForce(double r)  { return spline.slope(r); }
 
+// Energy and force / r from one spline lookup
+EnergyForce CustomPotential::evaluate(double r2) {
+    EnergyForce ef = {0, 0};
+    if (r2 > 9.0) { return ef; }
+    if (r2 < LJ_AT_3 * LJ_AT_3) { return evaluateLJ(r2); }
+    
+    double r = sqrt(r2), slope;
+    spline.valueSlope(r, ef.energy, slope);
+    ef.forceOverR = slope / r;
+    return ef;
+}
+
+// Energy and force / r for a block of pairs, with evaluate() called directly
+void CustomPotential::evaluateBlock(const double *r2, double *energy, double *forceOverR, int m, double rcut2) {
+    evaluateEach(*this, r2, energy, forceOverR, m, rcut2);
+}
+
 // Update the spline
 void CustomPotential::updatePoints(std::vector <cubic::Point> &points) {
     std::vector <cubic::Point> splinePoints;
@@ -186,4 +428,8 @@ void CustomPotential::updatePoints(std::vector <cubic::Point> &points) {
     // update spline
     spline.setPoints(splinePoints);
     spline.reconstruct();
+    controlPoints = points;
+    
+    // the table no longer matches the spline
+    invalidateTable();
 }
\ No newline at end of file
@@ -25,7 +25,9 @@
 #ifndef potentials_hpp
 #define potentials_hpp
 
+#include <algorithm>
 #include <cmath>
+#include <vector>
 #include "utilities.hpp"
 #include "cubicspline.hpp"
 
@@ -35,6 +37,20 @@ enum Potential {
     LENNARD_JONES, SQUARE_WELL, MORSE, CUSTOM
 };
 
+// The energy of a pair of particles and the force between them divided by their separation r,
+// so that the force on particle i is forceOverR * (rj - ri)
+struct EnergyForce {
+    double energy;
+    double forceOverR;
+};
+
+// Enumerate ways of interpolating between the points of a tabulated potential
+// TABLE_AUTO is cubic for a smooth potential and linear for one with jumps, as the cubic
+// overshoots next to a jump
+enum TableInterpolation {
+    TABLE_LINEAR, TABLE_CUBIC, TABLE_AUTO
+};
+
 // Base class - currently just an empty functor defining what every potential
 // functor must have, which is a force/energy calculating method with arguments
 // separation rij, force, and returning the potential energy.
@@ -52,10 +68,43 @@ protected:
     // 12-6 Lennard-Jones potential to lerp to, so that the repulsive wall is always LJ-like
     double calcEnergyLJ(double r);
     double calcForceLJ(double r);
+    EnergyForce evaluateLJ(double r2) const; // both at once, from r^2 only
     
     // Store type so can safely check type of potential being used
     Potential type;
     
+    // Optional table of the energy and force(r) / r, sampled at about tableSize + 1 evenly spaced
+    // values of r^2 from TABLE_R2_MIN to TABLE_R2_MAX. Below TABLE_R2_MIN, which is deep in the
+    // repulsive wall, the LJ wall is still evaluated directly.
+    // The table is split into segments at the values of r in tableBreaks, where the energy or
+    // force jumps, so that no interval straddles a jump. Each segment has its own even spacing,
+    // and one extra point at each end for cubic interpolation.
+    struct TableSegment {
+        double r2Start, r2End;  // range of r^2 covered by the segment
+        double dr2, invDr2;     // spacing of the segment in r^2, and its inverse
+        int first;              // index in the table of the extra point at its start
+        int size;               // number of intervals in the segment
+    };
+    
+    bool tabulated;                       // use the table in evaluateBlock?
+    bool tableDirty;                      // must the table be resampled before it is next used?
+    TableInterpolation tableInterpolation;
+    int tableSize;                        // number of intervals in the table
+    std::vector <double> tableBreaks;     // values of r where the potential jumps; empty if smooth
+    std::vector <TableSegment> tableSegments;
+    std::vector <double> tableEnergy, tableForce;
+    
+    // mark the table as out of date, to be called whenever the shape of the potential changes
+    void invalidateTable();
+    
+    // the interpolation actually used, with TABLE_AUTO resolved by whether the potential is smooth
+    TableInterpolation resolvedInterpolation() const;
+    
+    // evaluateBlock by calling pot.evaluate() for each pair, or the table in table mode
+    // Functor is the concrete type, so that evaluate() is called without going through the vtable
+    template <class Functor>
+    static void evaluateEach(Functor &pot, const double *r2, double *energy, double *forceOverR, int m, double rcut2);
+    
 public:
     
     PotentialFunctor(Potential type);
@@ -73,6 +122,38 @@ public:
     double potential(double r);
     double force(double r);
     
+    // the energy and force / r of a pair with squared separation r2, calculated together so that
+    // any intermediates are only found once; zero past the cutoff of 3.0
+    // this version calls potential() and force(), and subclasses override it with native versions
+    virtual EnergyForce evaluate(double r2);
+    
+    // number of pairs passed to evaluateBlock at once by the force calculation
+    constexpr static const int BLOCK = 8;
+    
+    // calculate the energy and force(r) / r for m (<= BLOCK) pairs with squared separations r2,
+    // giving zero for any pair with r2 >= rcut2
+    // this version calls evaluate() for each pair, and subclasses can hide it with a faster
+    // version; the MD system calls it through a pointer of the concrete type, so this is
+    // resolved at compile time
+    void evaluateBlock(const double *r2, double *energy, double *forceOverR, int m, double rcut2);
+    
+    // range of r^2 covered by the table; the potential is always zero beyond r = 3.0
+    constexpr static const double TABLE_R2_MIN = 0.64;
+    constexpr static const double TABLE_R2_MAX = 9.0;
+    
+    // switch table mode on or off, with the given interpolation and number of intervals
+    void setTabulated(bool on, TableInterpolation interpolation = TABLE_AUTO, int size = 4096);
+    bool isTabulated() const;
+    TableInterpolation getTableInterpolation() const;
+    int getTableSize() const;
+    
+    // resample the table if it is out of date; this is not thread-safe, so must be called before
+    // the force calculation is split over threads
+    void updateTable();
+    
+    // as evaluateBlock, but interpolating from the table, which must be up to date
+    void evaluateTableBlock(const double *r2, double *energy, double *forceOverR, int m, double rcut2) const;
+    
     // Return the type
     Potential getType() const;
 
@@ -81,7 +162,7 @@ public:
 
 // Lennard-Jones potential
 // V(r) = 4 * [ r^(-12) - r^(-6) ]
-class LennardJones : public PotentialFunctor
+class LennardJones final : public PotentialFunctor
 {
 private:
     // return an LJ potential
@@ -91,13 +172,17 @@ private:
 public:
     // Constructor
     LennardJones(); // A 12-6 potential with epsilon = sigma = 1
+    
+    // LJ only needs r^2, so these avoid the square root and pow calls, and the block is vectorisable
+    EnergyForce evaluate(double r2);
+    void evaluateBlock(const double *r2, double *energy, double *forceOverR, int m, double rcut2);
 };
 
 
 // Morse potential
 // V(r) = (1 - exp[-a(r - r_eq)])^2 - 1
 // r_eq = 2^(1/6), a = 5.85 to match LJ potential
-class Morse : public PotentialFunctor
+class Morse final : public PotentialFunctor
 {
 private:
     double a;    // The `width' of the potential, set to 5.85
@@ -110,13 +195,17 @@ private:
 public:
     // Constructor
     Morse();
+    
+    // energy and force with one exponential
+    EnergyForce evaluate(double r2);
+    void evaluateBlock(const double *r2, double *energy, double *forceOverR, int m, double rcut2);
 };
 
 
 // Square well potential
 // V(r) = -1 for 1.0 < r < 1.85, 0 for r > 1.85, and 'infinity' for r < 1.0
 // in practice, 'infinity' is a steep slope which connects to an LJ repulsion
-class SquareWell : public PotentialFunctor
+class SquareWell final : public PotentialFunctor
 {
 private:
     double lambda; // well goes from r = 1 to r = lambda (= 1.85)
@@ -127,15 +216,20 @@ public:
     // return the potential
     double calcEnergy(double r);
     double calcForce(double r);
+    
+    // energy and force with one pass through the branches
+    EnergyForce evaluate(double r2);
+    void evaluateBlock(const double *r2, double *energy, double *forceOverR, int m, double rcut2);
 };
 
 
 // Custom potential, defined by spline
-class CustomPotential : public PotentialFunctor
+class CustomPotential final : public PotentialFunctor
 {
 private:
     cubic::Spline spline;
     cubic::Point pointWallL, pointWallR, pointCutoff;
+    std::vector <cubic::Point> controlPoints; // the points between the fixed ones, as last given
     
     // return the potential
     double calcEnergy(double r);
@@ -150,7 +244,35 @@ public:
     
     // Rebuild spline from points
     void updatePoints(std::vector <cubic::Point> &points);
+    
+    // the points last given to updatePoints
+    const std::vector <cubic::Point>& getPoints() const;
+    
+    // gets the energy and force of each pair with one spline lookup, rather than one each
+    EnergyForce evaluate(double r2);
+    void evaluateBlock(const double *r2, double *energy, double *forceOverR, int m, double rcut2);
 };
 
 
+template <class Functor>
+void PotentialFunctor::evaluateEach(Functor &pot, const double *r2, double *energy, double *forceOverR, int m, double rcut2) {
+    if (pot.tabulated) {
+        pot.evaluateTableBlock(r2, energy, forceOverR, m, rcut2);
+        return;
+    }
+    
+    EnergyForce ef;
+    for (int k = 0; k < m; ++k) {
+        if (r2[k] < rcut2) {
+            ef = pot.evaluate(r2[k]);
+            energy[k] = ef.energy;
+            forceOverR[k] = ef.forceOverR;
+        } else {
+            energy[k] = 0;
+            forceOverR[k] = 0;
+        }
+    }
+}
+
+
 #endif /* potentials_hpp */
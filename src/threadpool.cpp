@@ -0,0 +1,117 @@
+/*
+ Argon
+ 
+ Copyright (c) 2016 David McDonagh, Robert Shaw, Staszek Welsh
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#include "threadpool.hpp"
+
+namespace md {
+    
+    // Start with no workers, so that tasks run on the calling thread only
+    ThreadPool::ThreadPool() : task(nullptr), generation(0), remaining(0), stopping(false) {}
+    
+    ThreadPool::~ThreadPool() { stopWorkers(); }
+    
+    int ThreadPool::getNThreads() const { return workers.size() + 1; }
+    
+    /*
+        ROUTINE setNThreads:
+            Stops any existing workers, then starts nthreads - 1 new ones. Values less than one
+            are treated as one, i.e. no workers.
+     */
+    void ThreadPool::setNThreads(int nthreads) {
+        if (nthreads < 1) { nthreads = 1; }
+        if (nthreads == getNThreads()) { return; }
+        
+        stopWorkers();
+        
+        stopping = false;
+        for (int i = 1; i < nthreads; ++i) {
+            workers.push_back(std::thread(&ThreadPool::workerLoop, this, i, generation));
+        }
+    }
+    
+    void ThreadPool::stopWorkers() {
+        {
+            std::lock_guard <std::mutex> lock(mutex);
+            stopping = true;
+        }
+        startWork.notify_all();
+        
+        for (std::size_t i = 0; i < workers.size(); ++i) { workers[i].join(); }
+        workers.clear();
+    }
+    
+    /*
+        ROUTINE workerLoop:
+            Waits for a new generation of task to be posted, runs its share of it, and then
+            signals the calling thread if it was the last worker to finish. seen is the generation
+            at the time the worker was started, so that a task posted before the worker first
+            waits is not missed.
+     */
+    void ThreadPool::workerLoop(int index, unsigned long seen) {
+        while (true) {
+            const std::function <void(int)> *current;
+            {
+                std::unique_lock <std::mutex> lock(mutex);
+                startWork.wait(lock, [&] () { return stopping || generation != seen; });
+                if (stopping) { return; }
+                seen = generation;
+                current = task;
+            }
+            
+            (*current)(index);
+            
+            {
+                std::lock_guard <std::mutex> lock(mutex);
+                if (--remaining == 0) { workDone.notify_one(); }
+            }
+        }
+    }
+    
+    /*
+        ROUTINE run:
+            Posts task to all the workers, runs task(0) on the calling thread, and then waits
+            for the workers to finish.
+     */
+    void ThreadPool::run(const std::function <void(int)> &_task) {
+        if (workers.empty()) {
+            _task(0);
+            return;
+        }
+        
+        {
+            std::lock_guard <std::mutex> lock(mutex);
+            task = &_task;
+            remaining = workers.size();
+            ++generation;
+        }
+        startWork.notify_all();
+        
+        _task(0);
+        
+        std::unique_lock <std::mutex> lock(mutex);
+        workDone.wait(lock, [&] () { return remaining == 0; });
+        task = nullptr;
+    }
+}
@@ -0,0 +1,79 @@
+/*
+ Argon
+ 
+ Copyright (c) 2016 David McDonagh, Robert Shaw, Staszek Welsh
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+
+#ifndef threadpool_hpp
+#define threadpool_hpp
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace md {
+    
+    class ThreadPool
+    {
+        /*
+            A fixed set of long-lived worker threads, so that the force calculation does not have to
+            create and join new threads every time step.
+         
+            run(task) calls task(t) once for each thread index t = 0 ... nthreads - 1, with t = 0 on the
+            calling thread and the rest on the workers, and returns once every call has finished, so
+            each call to run acts as a barrier. With one thread, the task is simply called directly.
+         */
+        
+    private:
+        std::vector <std::thread> workers;     // nthreads - 1 worker threads
+        
+        std::mutex mutex;                      // guards everything below
+        std::condition_variable startWork;     // signalled when a new task is posted
+        std::condition_variable workDone;      // signalled when the last worker finishes a task
+        
+        const std::function <void(int)> *task; // task being run, only valid during run()
+        unsigned long generation;              // incremented for every task posted
+        int remaining;                         // number of workers yet to finish the current task
+        bool stopping;                         // set to tell the workers to exit
+        
+        void workerLoop(int index, unsigned long seen); // main loop of worker thread index
+        void stopWorkers();                    // exit and join all the workers
+        
+    public:
+        ThreadPool();
+        ~ThreadPool();
+        
+        // The pool owns threads, so cannot be copied
+        ThreadPool(const ThreadPool &other) = delete;
+        ThreadPool& operator=(const ThreadPool &other) = delete;
+        
+        int getNThreads() const;               // number of threads, including the calling thread
+        void setNThreads(int nthreads);        // restart the pool with nthreads threads in total
+        
+        // Run task(t) for t = 0 ... nthreads - 1 in parallel, returning once all have finished
+        void run(const std::function <void(int)> &task);
+    };
+}
+
+#endif /* threadpool_hpp */
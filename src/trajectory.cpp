@@ -0,0 +1,270 @@
+/*
+ Argon
+ 
+ Copyright (c) 2016 David McDonagh, Robert Shaw, Staszek Welsh
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "trajectory.hpp"
+#include <cstring>
+#include <chrono>
+
+namespace md {
+    
+    /*
+        BinaryTrajectory
+     */
+    
+    BinaryTrajectory::BinaryTrajectory(int _flags, int _keyInterval) : flags(_flags), keyInterval(_keyInterval > 0 ? _keyInterval : 100), nframes(0) {}
+    
+    std::int64_t BinaryTrajectory::writeHeader(FILE *file) {
+        FileHeader header;
+        memcpy(header.magic, "ARGONTRJ", sizeof(header.magic));
+        header.version = VERSION;
+        header.endianCheck = 0x01020304;
+        header.flags = flags;
+        header.keyInterval = keyInterval;
+        
+        if (fwrite(&header, sizeof(header), 1, file) != 1) { return -1; }
+        return sizeof(header);
+    }
+    
+    template <class Real>
+    void BinaryTrajectory::append(const double *values, int n) {
+        std::size_t start = buffer.size();
+        buffer.resize(start + n * sizeof(Real));
+        char *out = buffer.data() + start;
+        
+        for (int i = 0; i < n; ++i) {
+            Real v = values[i];
+            memcpy(out + i * sizeof(Real), &v, sizeof(Real));
+        }
+    }
+    
+    void BinaryTrajectory::appendDelta(const double *values, std::vector <double> &last, int n) {
+        std::size_t start = buffer.size();
+        buffer.resize(start + n * sizeof(float));
+        char *out = buffer.data() + start;
+        
+        for (int i = 0; i < n; ++i) {
+            float d = values[i] - last[i];
+            memcpy(out + i * sizeof(float), &d, sizeof(float));
+            last[i] += d;
+        }
+    }
+    
+    std::int64_t BinaryTrajectory::writeFrame(FILE *file, const TrajectoryFrame &frame) {
+        int N = frame.N;
+        const double *x = frame.positions.x.data(), *y = frame.positions.y.data();
+        const double *vx = frame.velocities.x.data(), *vy = frame.velocities.y.data();
+        bool useFloat = flags & FLOAT;
+        bool key = !(flags & DELTA) || nframes % keyInterval == 0 || lastX.size() != (std::size_t)N;
+        
+        FrameHeader header = {frame.step, frame.time, frame.epot, frame.ekin, frame.box.x, frame.box.y,
+                              (std::uint32_t)N, (std::uint32_t)(key ? KEY_FRAME : DELTA_FRAME)};
+        buffer.resize(sizeof(header));
+        memcpy(buffer.data(), &header, sizeof(header));
+        
+        if (!key) {
+            appendDelta(x, lastX, N);
+            appendDelta(y, lastY, N);
+        } else {
+            if (useFloat) { append <float> (x, N); append <float> (y, N); }
+            else          { append <double> (x, N); append <double> (y, N); }
+            
+            // the positions as a reader will have them, for the differences in the next frames
+            if (flags & DELTA) {
+                lastX.assign(x, x + N);
+                lastY.assign(y, y + N);
+                if (useFloat) {
+                    for (int i = 0; i < N; ++i) { lastX[i] = (float)lastX[i]; lastY[i] = (float)lastY[i]; }
+                }
+            }
+        }
+        
+        if (useFloat) { append <float> (vx, N); append <float> (vy, N); }
+        else          { append <double> (vx, N); append <double> (vy, N); }
+        
+        ++nframes;
+        if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) { return -1; }
+        return buffer.size();
+    }
+    
+    /*
+        XYZTrajectory
+     */
+    
+    std::int64_t XYZTrajectory::writeFrame(FILE *file, const TrajectoryFrame &frame) {
+        std::int64_t bytes = fprintf(file, "%d\nstep %llu time %.6f epot %.10g ekin %.10g box %.10g %.10g\n",
+                                     frame.N, (unsigned long long)frame.step, frame.time, frame.epot, frame.ekin, frame.box.x, frame.box.y);
+        if (bytes < 0) { return -1; }
+        
+        for (int i = 0; i < frame.N; ++i) {
+            int n = fprintf(file, "Ar %.8f %.8f 0.0\n", frame.positions.x[i], frame.positions.y[i]);
+            if (n < 0) { return -1; }
+            bytes += n;
+        }
+        return bytes;
+    }
+    
+    /*
+        TrajectoryWriter
+     */
+    
+    TrajectoryWriter::TrajectoryWriter() : queue(1), stopping(false), file(nullptr), format(nullptr), interval(100), backpressure(DROP_FRAMES),
+        nsteps(0), time(0), framesQueued(0), framesWritten(0), framesDropped(0), bytesWritten(0), maxQueued(0), waitTime(0), failed(false) {}
+    
+    TrajectoryWriter::~TrajectoryWriter() { close(); }
+    
+    bool TrajectoryWriter::open(const std::string &path, TrajectoryFormat *_format, int _interval, int capacity, Backpressure _backpressure) {
+        if (file) {
+            delete _format;
+            return false;
+        }
+        
+        file = fopen(path.c_str(), "wb");
+        if (!file) {
+            delete _format;
+            return false;
+        }
+        
+        format = _format;
+        interval = _interval > 0 ? _interval : 1;
+        backpressure = _backpressure;
+        queue.setCapacity(capacity);
+        
+        nsteps = 0;
+        time = 0;
+        framesQueued = framesWritten = framesDropped = 0;
+        maxQueued = 0;
+        waitTime = 0;
+        
+        std::int64_t bytes = format->writeHeader(file);
+        failed = bytes < 0;
+        bytesWritten = bytes > 0 ? bytes : 0;
+        
+        stopping = false;
+        thread = std::thread(&TrajectoryWriter::loop, this);
+        return true;
+    }
+    
+    void TrajectoryWriter::close() {
+        if (!file) { return; }
+        
+        stopping = true;
+        if (thread.joinable()) { thread.join(); }
+        
+        if (fclose(file) != 0) { failed = true; }
+        file = nullptr;
+        delete format;
+        format = nullptr;
+    }
+    
+    bool TrajectoryWriter::isOpen() const { return file != nullptr; }
+    
+    /*
+        ROUTINE step:
+            Counts a step of the system, and on every interval-th step copies it into the next free
+            frame in the queue, waiting for one to become free with WAIT, or dropping the frame
+            with DROP_FRAMES. The copies are into frames which already have room for the particles,
+            so nothing is allocated once the queue has gone round once.
+     */
+    void TrajectoryWriter::step(const MDContainer &system) {
+        if (!file) { return; }
+        
+        time += system.getStepTime();
+        if (++nsteps % interval != 0) { return; }
+        
+        TrajectoryFrame *frame = queue.getBack();
+        if (!frame && backpressure == WAIT) {
+            auto start = std::chrono::steady_clock::now();
+            while (!frame && !failed) {
+                std::this_thread::yield();
+                frame = queue.getBack();
+            }
+            waitTime = waitTime + std::chrono::duration <double> (std::chrono::steady_clock::now() - start).count();
+        }
+        if (!frame) {
+            ++framesDropped;
+            return;
+        }
+        
+        frame->step = nsteps;
+        frame->time = time;
+        frame->epot = system.getEPot();
+        frame->ekin = system.getEKin();
+        frame->box = system.getBox();
+        frame->N = system.getN();
+        frame->positions = system.getPositions();
+        frame->velocities = system.getVelocities();
+        queue.push();
+        
+        ++framesQueued;
+        int queued = queue.size();
+        if (queued > maxQueued) { maxQueued = queued; }
+    }
+    
+    /*
+        ROUTINE loop:
+            The writer's thread: writes frames from the queue as they arrive, sleeping for a
+            millisecond whenever it is empty, until it is closed and the queue has been emptied.
+            After a failed write, frames are still taken from the queue but not written, so that
+            the simulation is never left waiting for room.
+     */
+    void TrajectoryWriter::loop() {
+        while (true) {
+            TrajectoryFrame *frame = queue.getFront();
+            
+            if (!frame) {
+                // stopping is checked before looking at the queue again, so that a frame pushed
+                // just before the writer was closed is still written
+                if (stopping) {
+                    if (!queue.getFront()) { break; }
+                } else {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                continue;
+            }
+            
+            if (!failed) {
+                std::int64_t bytes = format->writeFrame(file, *frame);
+                if (bytes < 0) {
+                    failed = true;
+                } else {
+                    bytesWritten += bytes;
+                    ++framesWritten;
+                }
+            }
+            queue.pop();
+        }
+    }
+    
+    TrajectoryStats TrajectoryWriter::getStats() const {
+        TrajectoryStats stats;
+        stats.framesQueued = framesQueued;
+        stats.framesWritten = framesWritten;
+        stats.framesDropped = framesDropped;
+        stats.bytesWritten = bytesWritten;
+        stats.maxQueued = maxQueued;
+        stats.waitTime = waitTime;
+        stats.failed = failed;
+        return stats;
+    }
+}
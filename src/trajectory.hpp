@@ -0,0 +1,211 @@
+/*
+ Argon
+ 
+ Copyright (c) 2016 David McDonagh, Robert Shaw, Staszek Welsh
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef trajectory_hpp
+#define trajectory_hpp
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "mdforces.hpp"
+
+namespace md {
+    
+    // The state of the system at one step, as saved in a trajectory
+    struct TrajectoryFrame
+    {
+        std::uint64_t step;   // number of steps since the writer was opened
+        double time;          // simulated time since the writer was opened
+        double epot, ekin;
+        coord box;
+        int N;
+        ParticleArray positions, velocities;
+    };
+    
+    class TrajectoryFormat
+    {
+        /*
+            A way of writing frames to a trajectory file, to be plugged into a TrajectoryWriter.
+            Both functions are called on the writer's own thread, and return the number of bytes
+            written, or -1 if the file could not be written.
+         */
+        
+    public:
+        virtual ~TrajectoryFormat() {}
+        
+        virtual std::int64_t writeHeader(FILE *) { return 0; }
+        virtual std::int64_t writeFrame(FILE *file, const TrajectoryFrame &frame) = 0;
+    };
+    
+    class BinaryTrajectory : public TrajectoryFormat
+    {
+        /*
+            Compact binary trajectories, in the byte order of the machine which wrote them.
+         
+            The file starts with a FileHeader, and each frame is a FrameHeader followed by the x
+            then the y components of the N positions, then of the N velocities. These are doubles,
+            or floats with the FLOAT flag, which halves the size of the file.
+         
+            With the DELTA flag, only every keyInterval-th frame (and any frame in which N has
+            changed) is a KEY_FRAME, stored as above. The others are DELTA_FRAMEs, in which the
+            positions are stored as float differences from those of the frame before. The
+            differences are taken from the positions as a reader will rebuild them, rather than
+            the exact ones, so rounding errors do not build up from frame to frame, and the
+            positions are far more precise than with FLOAT alone, since the differences are small.
+            This assumes the reader adds each float difference to a double running position, as
+            the writer does, so a reader which adds them up in float will drift from the positions
+            the writer saw.
+         */
+        
+    public:
+        enum Flags { FLOAT = 1, DELTA = 2 };
+        enum FrameKind { KEY_FRAME = 0, DELTA_FRAME = 1 };
+        
+        static const std::uint32_t VERSION = 1;
+        
+        struct FileHeader
+        {
+            char magic[8];            // "ARGONTRJ"
+            std::uint32_t version;
+            std::uint32_t endianCheck; // 0x01020304, which reads differently with the other byte order
+            std::uint32_t flags;
+            std::uint32_t keyInterval;
+        };
+        
+        struct FrameHeader
+        {
+            std::uint64_t step;
+            double time, epot, ekin, width, height;
+            std::uint32_t N;
+            std::uint32_t kind;       // a FrameKind
+        };
+        
+        BinaryTrajectory(int flags = 0, int keyInterval = 100);
+        
+        std::int64_t writeHeader(FILE *file);
+        std::int64_t writeFrame(FILE *file, const TrajectoryFrame &frame);
+        
+    private:
+        int flags, keyInterval;
+        std::uint64_t nframes;               // frames written so far
+        std::vector <double> lastX, lastY;   // positions of the last frame, as a reader rebuilds them
+        std::vector <char> buffer;           // each frame is put together here, then written at once
+        
+        // add n values to the buffer, as Reals, or as float differences from last, which is then
+        // moved on by the same differences
+        template <class Real>
+        void append(const double *values, int n);
+        void appendDelta(const double *values, std::vector <double> &last, int n);
+    };
+    
+    class XYZTrajectory : public TrajectoryFormat
+    {
+        /*
+            Plain text trajectories in the XYZ format which most visualisation programs read: for
+            each frame, the number of atoms, a comment line with the step, time and energies, and
+            a line for each atom with its element and x, y, z coordinates, with z = 0.
+         */
+        
+    public:
+        std::int64_t writeFrame(FILE *file, const TrajectoryFrame &frame);
+    };
+    
+    // Counts kept by a TrajectoryWriter, to see whether it is keeping up with the simulation
+    struct TrajectoryStats
+    {
+        std::uint64_t framesQueued;   // frames copied into the queue
+        std::uint64_t framesWritten;  // frames written to the file
+        std::uint64_t framesDropped;  // frames skipped because the queue was full
+        std::uint64_t bytesWritten;
+        int maxQueued;                // most frames waiting in the queue at once
+        double waitTime;              // seconds the simulation spent waiting for room in the queue
+        bool failed;                  // true if a write failed, after which nothing more is written
+    };
+    
+    class TrajectoryWriter
+    {
+        /*
+            Saves a trajectory of an MDContainer, a frame every few steps, without holding up the
+            simulation to write it.
+         
+            The system gives the writer every step (see MDContainer::setTrajectory), and every
+            interval-th step is copied into a frame in a fixed-size queue, which is all the
+            thread running the simulation does. The frames are written to the file in the given
+            format by a thread of the writer's own, so the memory used is bounded by the size of
+            the queue however fast the simulation runs. If the disk cannot keep up and the queue
+            fills, new frames are either dropped (DROP_FRAMES), or the simulation waits for room
+            (WAIT); the stats show how often either happens.
+         */
+        
+    public:
+        enum Backpressure { DROP_FRAMES, WAIT };
+        
+        TrajectoryWriter();
+        ~TrajectoryWriter(); // closes the file
+        
+        TrajectoryWriter(const TrajectoryWriter &other) = delete;
+        TrajectoryWriter& operator=(const TrajectoryWriter &other) = delete;
+        
+        // Start writing to the file at path, a frame every interval steps, with room for capacity
+        // frames in the queue; the writer takes ownership of format. Returns false if the file
+        // cannot be opened, or the writer is already open.
+        bool open(const std::string &path, TrajectoryFormat *format, int interval = 100, int capacity = 16, Backpressure backpressure = DROP_FRAMES);
+        
+        // Write any frames still queued and close the file
+        void close();
+        bool isOpen() const;
+        
+        // Called by the system after every step, on the thread running it
+        void step(const MDContainer &system);
+        
+        TrajectoryStats getStats() const;
+        
+    private:
+        util::SPSCQueue <TrajectoryFrame> queue;
+        std::thread thread;
+        std::atomic <bool> stopping;
+        
+        FILE *file;
+        TrajectoryFormat *format;
+        int interval;
+        Backpressure backpressure;
+        
+        // step count and time, kept by the thread running the system
+        std::uint64_t nsteps;
+        double time;
+        
+        // stats, written by one thread or the other, and read by either
+        std::atomic <std::uint64_t> framesQueued, framesWritten, framesDropped, bytesWritten;
+        std::atomic <int> maxQueued;
+        std::atomic <double> waitTime;
+        std::atomic <bool> failed;
+        
+        void loop();
+    };
+}
+
+#endif /* trajectory_hpp */
@@ -23,6 +23,15 @@
  */
 
 #include "utilities.hpp"
+#include <algorithm>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace util {
     double clamp(double value, double min, double max) {
@@ -55,7 +64,7 @@ namespace util {
     }
     
     coord biclamp(coord point, rect limits) {
-        return biclamp(point, limits.min, limits.max);
+        return biclamp(point, limits.getPos(POS_TOP_LEFT), limits.getPos(POS_BOTTOM_RIGHT));
     }
     
     coord bilerp(double t, coord min, coord max, bool clamp) {
@@ -76,36 +85,219 @@ namespace util {
     }
 
     // Takes in an input vector and returns a binned histogram of the numbers
-    // NOTE: this will sort the vector passed in
-    // make a copy of data and pass that if you don't want the order of its elements changed
-    std::vector <double> histogram(std::vector <double> &data, double min, double max, int bins) {
-        int N = data.size();
-        std::sort(data.begin(), data.end());
-        
+    // The bin of each value is found directly from (value - min) / width, so there is no need to
+    // sort the data, and it is not changed
+    std::vector <double> histogram(const std::vector <double> &data, double min, double max, int bins) {
+        return histogram(data.data(), data.size(), min, max, bins);
+    }
+    
+    std::vector <double> histogram(const double *data, int n, double min, double max, int bins) {
         std::vector <double> hist(bins, 0);
+        histogramAdd(data, n, min, max, hist.data(), bins);
+        normaliseHistogram(hist);
+        return hist;
+    }
+    
+    // The values are taken in blocks: first the bin indices of a whole block are worked out,
+    // with -1 for values out of range, in a loop with no branches which the compiler can
+    // vectorise, and then the bins are incremented. A value equal to max goes in the last bin.
+    void histogramAdd(const double *data, int n, double min, double max, double *hist, int bins) {
+        if (bins < 1 || !(max > min)) { return; }
         
-        double bin_width = (max - min) / bins;
-        int curr_bin = 0;
+        const int BLOCK = 64;
+        int index[BLOCK];
+        const double scale = bins / (max - min);
+        const int last = bins - 1;
         
-        for (int i = 0; i < N; ++i) {
-            if (data[i] < min) { continue; }
-            if (data[i] > max) { break; }
-            double bin_max = min + bin_width * (curr_bin + 1);
+        for (int start = 0; start < n; start += BLOCK) {
+            int m = n - start < BLOCK ? n - start : BLOCK;
+            const double *block = data + start;
             
-            while (data[i] > bin_max) {
-                ++curr_bin;
-                bin_max = min + bin_width * (curr_bin + 1);
+            for (int k = 0; k < m; ++k) {
+                double v = block[k];
+                int b = (v >= min && v <= max) ? (int)((v - min) * scale) : -1;
+                index[k] = b < last ? b : last;
+            }
+            for (int k = 0; k < m; ++k) {
+                if (index[k] >= 0) { hist[index[k]] += 1.0; }
             }
-            
-            hist[curr_bin] += 1.0;
         }
-        
+    }
+    
+    void normaliseHistogram(std::vector <double> &hist) {
         double sum = 0.0;
-        for (int i = 0; i < bins; ++i) { sum += hist[i]; }
+        for (std::size_t i = 0; i < hist.size(); ++i) { sum += hist[i]; }
         if (sum > 0) {
-            for (int i = 0; i < bins; ++i) { hist[i] /= sum; }
+            for (std::size_t i = 0; i < hist.size(); ++i) { hist[i] /= sum; }
         }
+    }
+    
+    // SlidingWindow
+    
+    SlidingWindow::SlidingWindow(int _capacity) : capacity(0) { setCapacity(_capacity); }
+    
+    int SlidingWindow::getCapacity() const { return capacity; }
+    
+    void SlidingWindow::setCapacity(int _capacity) {
+        capacity = _capacity > 0 ? _capacity : 1;
+        values.assign(capacity, 0.0);
+        maxQueue.assign(capacity, 0);
+        minQueue.assign(capacity, 0);
+        clear();
+    }
+    
+    int SlidingWindow::size() const { return pushed < capacity ? pushed : capacity; }
+    
+    void SlidingWindow::clear() {
+        pushed = 0;
+        maxHead = maxSize = minHead = minSize = 0;
+    }
+    
+    void SlidingWindow::push(double v) {
+        long long k = pushed++;
+        values[k % capacity] = v;
         
-        return hist;
+        // drop the sample which has just left the window from the front of the queues
+        long long oldest = k - capacity + 1;
+        if (maxSize > 0 && maxQueue[maxHead] < oldest) { maxHead = (maxHead + 1) % capacity; --maxSize; }
+        if (minSize > 0 && minQueue[minHead] < oldest) { minHead = (minHead + 1) % capacity; --minSize; }
+        
+        // drop samples from the back which can no longer be the maximum/minimum, then add this one
+        while (maxSize > 0 && value(maxQueue[(maxHead + maxSize - 1) % capacity]) <= v) { --maxSize; }
+        maxQueue[(maxHead + maxSize++) % capacity] = k;
+        while (minSize > 0 && value(minQueue[(minHead + minSize - 1) % capacity]) >= v) { --minSize; }
+        minQueue[(minHead + minSize++) % capacity] = k;
+    }
+    
+    double SlidingWindow::get(int nstep) const { return value(pushed - 1 - nstep); }
+    
+    double SlidingWindow::getMin() const { return minSize > 0 ? value(minQueue[minHead]) : 0.0; }
+    double SlidingWindow::getMax() const { return maxSize > 0 ? value(maxQueue[maxHead]) : 0.0; }
+    
+    std::vector <coord> SlidingWindow::downsample(int buckets) const {
+        int n = size();
+        std::vector <coord> points;
+        
+        // nothing to gain if there are no more values than points
+        if (buckets < 1 || n <= 2 * buckets) {
+            points.reserve(n);
+            for (int i = 0; i < n; ++i) { points.push_back(coord(i, get(i))); }
+            return points;
+        }
+        
+        points.reserve(2 * buckets);
+        for (int b = 0; b < buckets; ++b) {
+            int start = (long long)n * b / buckets, end = (long long)n * (b + 1) / buckets;
+            int imin = start, imax = start;
+            for (int i = start + 1; i < end; ++i) {
+                double v = get(i);
+                if (v < get(imin)) { imin = i; }
+                if (v > get(imax)) { imax = i; }
+            }
+            
+            // keep the two points in time order
+            int first = imin < imax ? imin : imax, second = imin < imax ? imax : imin;
+            points.push_back(coord(first, get(first)));
+            if (second != first) { points.push_back(coord(second, get(second))); }
+        }
+        return points;
+    }
+    
+    // RunningHistogram
+    
+    RunningHistogram::RunningHistogram(int _bins, int _capacity) { resize(_bins, _capacity); }
+    
+    int RunningHistogram::getBins() const { return bins; }
+    int RunningHistogram::getCapacity() const { return capacity; }
+    
+    void RunningHistogram::resize(int _bins, int _capacity) {
+        bins = _bins > 0 ? _bins : 1;
+        capacity = _capacity > 0 ? _capacity : 1;
+        frames.assign(bins * capacity, 0.0);
+        sum.assign(bins, 0.0);
+        pushed = 0;
     }
-};
\ No newline at end of file
+    
+    int RunningHistogram::size() const { return pushed < capacity ? pushed : capacity; }
+    
+    void RunningHistogram::clear() {
+        std::fill(sum.begin(), sum.end(), 0.0);
+        pushed = 0;
+    }
+    
+    void RunningHistogram::push(const double *hist) {
+        double *frame = frames.data() + (pushed % capacity) * bins;
+        
+        // the slot being overwritten holds the oldest histogram once the window is full
+        if (pushed >= capacity) {
+            for (int i = 0; i < bins; ++i) { sum[i] += hist[i] - frame[i]; }
+        } else {
+            for (int i = 0; i < bins; ++i) { sum[i] += hist[i]; }
+        }
+        std::copy(hist, hist + bins, frame);
+        ++pushed;
+    }
+    
+    const std::vector <double>& RunningHistogram::getSum() const { return sum; }
+    
+    std::vector <double> RunningHistogram::getAverage() const {
+        std::vector <double> average = sum;
+        normaliseHistogram(average);
+        return average;
+    }
+    
+    // MappedFile
+    
+    MappedFile::MappedFile() : data(nullptr), size(0), mapped(false) {}
+    MappedFile::~MappedFile() { close(); }
+    
+    bool MappedFile::open(const std::string &path) {
+        close();
+        
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) { return false; }
+        
+        struct stat info;
+        if (fstat(fd, &info) != 0) { ::close(fd); return false; }
+        size = info.st_size;
+        
+        // an empty file cannot be mapped, but is still a valid (empty) file
+        if (size > 0) {
+            void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) { ::close(fd); size = 0; return false; }
+            data = (const char *)map;
+            mapped = true;
+        }
+        ::close(fd); // the mapping stays valid after the file is closed
+        return true;
+#else
+        FILE *file = fopen(path.c_str(), "rb");
+        if (!file) { return false; }
+        
+        char chunk[65536];
+        std::size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) { buffer.insert(buffer.end(), chunk, chunk + n); }
+        bool ok = !ferror(file);
+        fclose(file);
+        
+        if (!ok) { buffer.clear(); return false; }
+        data = buffer.data();
+        size = buffer.size();
+        return true;
+#endif
+    }
+    
+    void MappedFile::close() {
+#ifndef _WIN32
+        if (mapped) { munmap((void *)data, size); }
+#endif
+        data = nullptr;
+        size = 0;
+        mapped = false;
+        buffer.clear();
+    }
+    
+    const char* MappedFile::getData() const { return data; }
+    std::size_t MappedFile::getSize() const { return size; }
+};
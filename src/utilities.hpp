@@ -25,6 +25,13 @@
 #ifndef utilities_hpp
 #define utilities_hpp
 
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <new>
+#include <atomic>
+#include <vector>
+#include <string>
 #include "platform.hpp"
 
 namespace util {
@@ -63,8 +70,267 @@ namespace util {
     // overloads assume that a coord is equivalent to a rect with top-left of (0, 0)
     coord bimap(coord point, coord in, coord out, bool clamp = false);
     
-    // create a histogram from a data set
-    std::vector <double> histogram(std::vector <double> &data, double min, double max, int bins);
+    // create a histogram from a data set, or from the n values starting at data, with the given
+    // number of equal bins between min and max, normalised so that the bins sum to one
+    // values outside [min, max] are left out
+    std::vector <double> histogram(const std::vector <double> &data, double min, double max, int bins);
+    std::vector <double> histogram(const double *data, int n, double min, double max, int bins);
+    
+    // add the counts of the n values starting at data to the bins already in hist, without
+    // normalising, so that a histogram can be built up over several calls or frames, or one
+    // set of bins per thread can be filled in and the sets added together at the end
+    void histogramAdd(const double *data, int n, double min, double max, double *hist, int bins);
+    
+    // scale the bins so that they sum to one, if they are not all zero
+    void normaliseHistogram(std::vector <double> &hist);
+    
+    // allocator for std::vector which aligns the data to Alignment bytes (a cache line by default),
+    // so that loops over arrays of doubles can use aligned SIMD loads and stores
+    // e.g. std::vector <double, util::AlignedAllocator <double>> x;
+    template <typename T, std::size_t Alignment = 64>
+    struct AlignedAllocator
+    {
+        typedef T value_type;
+        template <typename U> struct rebind { typedef AlignedAllocator <U, Alignment> other; };
+        
+        AlignedAllocator() {}
+        template <typename U> AlignedAllocator(const AlignedAllocator <U, Alignment> &) {}
+        
+        // over-allocate, then store the pointer to the real allocation just before the aligned block
+        T* allocate(std::size_t n) {
+            void *raw = ::operator new(n * sizeof(T) + Alignment + sizeof(void *));
+            std::uintptr_t start = reinterpret_cast <std::uintptr_t> (raw) + sizeof(void *);
+            std::uintptr_t aligned = (start + Alignment - 1) & ~(std::uintptr_t)(Alignment - 1);
+            reinterpret_cast <void **> (aligned)[-1] = raw;
+            return reinterpret_cast <T *> (aligned);
+        }
+        
+        void deallocate(T *p, std::size_t) {
+            if (p) { ::operator delete(reinterpret_cast <void **> (p)[-1]); }
+        }
+        
+        template <typename U> bool operator==(const AlignedAllocator <U, Alignment> &) const { return true; }
+        template <typename U> bool operator!=(const AlignedAllocator <U, Alignment> &) const { return false; }
+    };
+    
+    // the last few values of a time series, e.g. an energy, in a fixed-size ring buffer, with the
+    // minimum and maximum over the stored values available at any time
+    // the minimum and maximum are tracked with monotonic queues of sample numbers (the maximum
+    // queue holds the samples which are bigger than everything pushed after them, and the minimum
+    // queue the smaller ones), so pushing a value costs O(1) amortised, however long the window
+    class SlidingWindow
+    {
+    private:
+        int capacity;                 // maximum number of values stored
+        long long pushed;             // total number of values ever pushed
+        std::vector <double> values;  // value number k is in values[k % capacity]
+        
+        // monotonic queues of sample numbers, as ring buffers with room for capacity entries
+        std::vector <long long> maxQueue, minQueue;
+        int maxHead, maxSize, minHead, minSize;
+        
+        double value(long long k) const { return values[k % capacity]; }
+        
+    public:
+        SlidingWindow(int capacity = 120);
+        
+        int getCapacity() const;
+        void setCapacity(int capacity); // also clears the window
+        
+        int size() const;
+        void clear();
+        
+        // add a value, dropping the oldest if the window is full
+        void push(double v);
+        
+        // the value nstep values ago, so get(0) is the most recent
+        double get(int nstep) const;
+        
+        // minimum and maximum of the stored values, or 0 if there are none
+        double getMin() const;
+        double getMax() const;
+        
+        // a reduced view for drawing: the stored values are split into the given number of buckets,
+        // each of which contributes its minimum and maximum, in order, as (nstep, value) points
+        // every peak and trough is kept, unlike simply taking every nth value
+        std::vector <coord> downsample(int buckets) const;
+    };
+
+    // the sum of the last few histograms of a time series, e.g. a speed distribution, kept up to
+    // date as each one is pushed by adding it and subtracting the one which drops out, so that the
+    // average over the window is available without going over every stored histogram
+    // the histograms are stored in one block allocated up front; pushing raw counts keeps the
+    // sum exact, since whole numbers are added and subtracted without rounding
+    class RunningHistogram
+    {
+    private:
+        int bins, capacity;
+        long long pushed;              // total number of histograms ever pushed
+        std::vector <double> frames;   // histogram number k is at frames[(k % capacity) * bins]
+        std::vector <double> sum;      // sum of the stored histograms
+        
+    public:
+        RunningHistogram(int bins = 100, int capacity = 40);
+        
+        int getBins() const;
+        int getCapacity() const;
+        void resize(int bins, int capacity); // also clears the window
+        
+        int size() const;
+        void clear();
+        
+        // add a histogram of getBins() bins, dropping the oldest if the window is full
+        void push(const double *hist);
+        
+        // the bin by bin sum of the stored histograms, and the same normalised to sum to one
+        const std::vector <double>& getSum() const;
+        std::vector <double> getAverage() const;
+    };
+    
+    // three copies of an object, for passing it from one writer thread to one reader thread
+    // without locks. The writer fills in the back copy and publishes it, swapping it with the
+    // middle copy; the reader swaps the middle copy for its front copy when a newer one has been
+    // published. Each thread only ever touches its own copy, so the reader always sees a complete
+    // object which does not change under it, and neither thread ever waits for the other.
+    template <class T>
+    class TripleBuffer
+    {
+    private:
+        static const int FRESH = 4; // set in middle when the reader has not yet seen that copy
+        
+        T buffers[3];
+        int front, back;            // indices of the reader's and the writer's copies
+        std::atomic <int> middle;   // index of the copy in between, plus the FRESH flag
+        
+    public:
+        TripleBuffer() : front(0), back(1), middle(2) {}
+        
+        TripleBuffer(const TripleBuffer &other) = delete;
+        TripleBuffer& operator=(const TripleBuffer &other) = delete;
+        
+        // writer: the copy to fill in, and hand it over to the reader once it is complete
+        T& getBack() { return buffers[back]; }
+        void publish() { back = middle.exchange(back | FRESH) & ~FRESH; }
+        
+        // reader: move on to the most recently published copy, returning false if there is none
+        // newer than the current one, and the current copy
+        bool acquire() {
+            if (!(middle.load() & FRESH)) { return false; }
+            front = middle.exchange(front) & ~FRESH;
+            return true;
+        }
+        const T& getFront() const { return buffers[front]; }
+    };
+    
+    // a fixed-size queue of objects passed from one producer thread to one consumer thread without
+    // locks, e.g. frames to be written to disk. The objects are made up front and reused, so once
+    // they are big enough, nothing is allocated as the queue is used. The producer fills in the
+    // back slot and pushes it, and the consumer reads the front slot and pops it; each counter is
+    // only written by one thread, and a slot is never touched by both at once.
+    template <class T>
+    class SPSCQueue
+    {
+    private:
+        std::vector <T> slots;
+        std::atomic <std::uint64_t> head, tail; // number of objects ever popped and pushed
+        
+    public:
+        SPSCQueue(int capacity = 1) : slots(capacity > 0 ? capacity : 1), head(0), tail(0) {}
+        
+        SPSCQueue(const SPSCQueue &other) = delete;
+        SPSCQueue& operator=(const SPSCQueue &other) = delete;
+        
+        // number of slots; changing it empties the queue, so neither thread may be using it
+        int getCapacity() const { return slots.size(); }
+        void setCapacity(int capacity) { slots.resize(capacity > 0 ? capacity : 1); head = tail = 0; }
+        
+        int size() const { return tail.load() - head.load(); }
+        
+        // producer: the slot to fill in, or nullptr if the queue is full, and hand it over
+        T* getBack() {
+            std::uint64_t t = tail.load(std::memory_order_relaxed);
+            if (t - head.load(std::memory_order_acquire) == slots.size()) { return nullptr; }
+            return &slots[t % slots.size()];
+        }
+        void push() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+        
+        // consumer: the oldest slot pushed, or nullptr if the queue is empty, and give it back
+        T* getFront() {
+            std::uint64_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire)) { return nullptr; }
+            return &slots[h % slots.size()];
+        }
+        void pop() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+    };
+    
+    // a whole file mapped read-only into memory, so that its contents can be read in place without
+    // first being copied into a buffer; where memory mapping is not available (Windows), the file
+    // is read into a buffer owned by the object instead
+    class MappedFile
+    {
+    private:
+        const char *data;
+        std::size_t size;
+        bool mapped;              // true if data is a mapping, rather than pointing into buffer
+        std::vector <char> buffer;
+        
+    public:
+        MappedFile();
+        ~MappedFile();
+        
+        MappedFile(const MappedFile &other) = delete;
+        MappedFile& operator=(const MappedFile &other) = delete;
+        
+        // map the file at path, closing any file already open; returns false if it cannot be read
+        bool open(const std::string &path);
+        void close();
+        
+        const char* getData() const;
+        std::size_t getSize() const;
+    };
+    
+    // counter-based random number generator
+    // each random number is a hash of the seed and two counters, e.g. a step number and a particle
+    // index, rather than the next value from a sequential state. Any number can be drawn in any order
+    // on any thread, so loops over particles can be split between threads, and a run gives the same
+    // numbers from the same seed however many threads it uses.
+    // the hash is two rounds of the SplitMix64 finaliser
+    class CounterRNG
+    {
+    private:
+        std::uint64_t seed;
+        
+        static std::uint64_t mix(std::uint64_t z) {
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+        
+    public:
+        CounterRNG(std::uint64_t _seed = 0) : seed(_seed) {}
+        
+        void setSeed(std::uint64_t _seed) { seed = _seed; }
+        std::uint64_t getSeed() const { return seed; }
+        
+        // 64 random bits for counters a and b
+        std::uint64_t bits(std::uint64_t a, std::uint64_t b) const {
+            return mix(mix(seed + a * 0x9e3779b97f4a7c15ULL) ^ (b * 0xd1b54a32d192ed03ULL + 1));
+        }
+        
+        // uniform random number in (0, 1] for counters a and b
+        double uniform(std::uint64_t a, std::uint64_t b) const {
+            return ((bits(a, b) >> 11) + 1) * (1.0 / 9007199254740992.0); // 53 bits / 2^53
+        }
+        
+        // pair of independent normal random numbers with mean 0 and standard deviation sigma,
+        // by the Box-Muller transform, for counters a and b
+        coord normal2(std::uint64_t a, std::uint64_t b, double sigma) const {
+            double r = sigma * sqrt(-2.0 * log(uniform(a, 2 * b)));
+            double theta = 6.283185307179586 * uniform(a, 2 * b + 1);
+            coord z = {r * cos(theta), r * sin(theta)};
+            return z;
+        }
+    };
 };
 
 #endif /* utilities_hpp */